@@ -1,8 +1,21 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <cstdint>
 #include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "maptel.h"
 
 #ifdef NDEBUG
@@ -13,34 +26,715 @@ const bool DEBUG = true;
 
 using namespace std;
 
-typedef unordered_map<string, string> maptel;
-
 namespace {
+    // Number of entries above which a page is split in two. Cloned 
+    // dictionaries share their pages and copy only the ones being 
+    // modified, so a write after a clone copies at most this many entries.
+    const size_t PAGE_ENTRIES = 256U;
+
+    // Bound on the number of the lower bits of the hash selecting a page. 
+    // Stops the directory from doubling on numbers chosen to collide, 
+    // their pages grow past PAGE_ENTRIES instead.
+    const unsigned MAX_DEPTH = 20U;
+
+    // Change of the number src to the number dst stored inline. An entry 
+    // with an empty src is free and its dst holds the index of the next 
+    // free entry.
+    struct entry {
+        char src[TEL_NUM_MAX_LEN + 1];
+        char dst[TEL_NUM_MAX_LEN + 1];
+    };
+
+    // Slot of the hash table: index of the entry increased by one (zero 
+    // marks an empty slot) and the upper half of the hash of its number.
+    struct slot {
+        uint32_t entry;
+        uint32_t hash;
+    };
+
+    const uint32_t NO_ENTRY = UINT32_MAX;
+
+    // Returns the hash of the number num. The lower bits select a page, 
+    // the upper ones a slot within the page.
+    uint64_t hash_of(const char *num) {
+        uint64_t h = 14695981039346656037ULL;
+        for (; *num; num++) {
+            h ^= static_cast<unsigned char>(*num);
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // Copies the number src into the fixed size buffer dst.
+    void copy_number(char (&dst)[TEL_NUM_MAX_LEN + 1], const char *src) {
+        strncpy(dst, src, TEL_NUM_MAX_LEN);
+        dst[TEL_NUM_MAX_LEN] = '\0';
+    }
+
+    // Page of a dictionary. The entries live in a single slab growing 
+    // geometrically, the erased ones are reused through a free list. They 
+    // are indexed by an open addressing hash table with linear probing. 
+    // Destroying a page releases just these two buffers, regardless of 
+    // the number of entries. The numbers of a page share the lowest depth 
+    // bits of their hashes.
+    struct page {
+        vector<entry> entries;
+        vector<slot> slots;
+        uint32_t free_entry = NO_ENTRY;
+        size_t used = 0;
+        unsigned depth = 0;
+
+        // Returns the position of the slot holding the number num or of 
+        // the empty slot ending its probe sequence.
+        size_t locate(const char *num, uint64_t h) const {
+            size_t mask = slots.size() - 1;
+            uint32_t hi = static_cast<uint32_t>(h >> 32);
+            size_t i = hi & mask;
+            for (; slots[i].entry; i = (i + 1) & mask)
+                if (slots[i].hash == hi && 
+                    strcmp(entries[slots[i].entry - 1].src, num) == 0)
+                    break;
+            return i;
+        }
+
+        const entry *find(const char *num, uint64_t h) const {
+            if (slots.empty()) return nullptr;
+            const slot& s = slots[locate(num, h)];
+            return s.entry ? &entries[s.entry - 1] : nullptr;
+        }
+
+        void set(const char *src, const char *dst, uint64_t h) {
+            if ((used + 1) * 4 > slots.size() * 3)
+                rehash(max<size_t>(16, slots.size() * 2));
+            slot& s = slots[locate(src, h)];
+            if (!s.entry) {
+                s.entry = allocate() + 1;
+                s.hash = static_cast<uint32_t>(h >> 32);
+                copy_number(entries[s.entry - 1].src, src);
+                used++;
+            }
+            copy_number(entries[s.entry - 1].dst, dst);
+        }
+
+        bool erase(const char *src, uint64_t h) {
+            if (slots.empty()) return false;
+            size_t mask = slots.size() - 1;
+            size_t i = locate(src, h);
+            if (!slots[i].entry) return false;
+            release(slots[i].entry - 1);
+            used--;
+
+            // Backward shift deletion keeps the probe sequences unbroken 
+            // without tombstones.
+            for (size_t j = (i + 1) & mask; slots[j].entry; j = (j + 1) & mask) {
+                size_t home = slots[j].hash & mask;
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                    slots[i] = slots[j];
+                    i = j;
+                }
+            }
+            slots[i] = slot();
+            return true;
+        }
+
+        uint32_t allocate() {
+            if (free_entry == NO_ENTRY) {
+                entries.push_back(entry());
+                return static_cast<uint32_t>(entries.size() - 1);
+            }
+            uint32_t idx = free_entry;
+            memcpy(&free_entry, entries[idx].dst, sizeof(free_entry));
+            return idx;
+        }
+
+        void release(uint32_t idx) {
+            entries[idx].src[0] = '\0';
+            memcpy(entries[idx].dst, &free_entry, sizeof(free_entry));
+            free_entry = idx;
+        }
+
+        void rehash(size_t size) {
+            vector<slot> old_slots(size);
+            old_slots.swap(slots);
+            for (const slot& s : old_slots) {
+                if (!s.entry) continue;
+                size_t i = s.hash & (size - 1);
+                while (slots[i].entry) i = (i + 1) & (size - 1);
+                slots[i] = s;
+            }
+        }
+
+        size_t memory() const {
+            return sizeof(*this) + entries.capacity() * sizeof(entry) 
+                 + slots.capacity() * sizeof(slot);
+        }
+    };
+
+    // Dictionary of changes together with its usage counters. The pages 
+    // form an extendible hash table: the directory of pages is indexed by 
+    // the lowest bits of the hash, a page of depth d is referenced by all 
+    // the directory slots agreeing on the lowest d bits. A full page is 
+    // split alone, doubling the directory only when its depth reaches the 
+    // one of the directory. The counters are updated regardless of the 
+    // DEBUG flag, as they cost a few increments per call. An empty 
+    // dictionary allocates no page. All the fields are guarded by the 
+    // mutex of the dictionary.
+    struct maptel {
+        mutex mtx;
+        vector<shared_ptr<page>> pages = vector<shared_ptr<page>>(1);
+        unsigned long inserts = 0UL;
+        unsigned long erases = 0UL;
+        unsigned long transforms = 0UL;
+        unsigned long chain_hist[MAPTEL_CHAIN_HIST_LEN] = {};
+        unsigned long cycles = 0UL;
+    };
+
+    // Number of shards of the registry of dictionaries.
+    const size_t REGISTRY_SHARDS = 64U;
+
+    // Shard of the registry of dictionaries. Consecutive ids fall into 
+    // different shards, so creating, deleting and looking up unrelated 
+    // dictionaries do not meet on the same lock. The lock is held only 
+    // to find the dictionary; its operations run under its own mutex.
+    struct alignas(64) registry_shard {
+        mutex mtx;
+        unordered_map<unsigned long, shared_ptr<maptel>> maps;
+    };
+
     // Counter of the created dictionaries;
-    unsigned long maptel_counter = 0UL;
+    atomic<unsigned long> maptel_counter(0UL);
 
     // Application of the 'Construct on first use' idiom; 
     // prevents a static initialization order fiasco.
-    unordered_map<unsigned long, maptel>& maptel_map() {
-        static unordered_map<unsigned long, maptel> maptel_map_inst;
-        return maptel_map_inst;
+    registry_shard& maptel_shard(unsigned long id) {
+        static registry_shard maptel_registry[REGISTRY_SHARDS];
+        return maptel_registry[id % REGISTRY_SHARDS];
+    }
+
+    // Returns the dictionary with the id or nullptr if there is none. 
+    // The dictionary stays alive as long as the returned pointer, even 
+    // if it gets deleted meanwhile.
+    shared_ptr<maptel> find_map(unsigned long id) {
+        registry_shard& shard = maptel_shard(id);
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.maps.find(id);
+        return it != shard.maps.end() ? it->second : nullptr;
     }
 
-    // Checks if there is a dictionary with the id.
-    bool map_exist(unsigned long id) {
-        return maptel_map().find(id) != maptel_map().end();
+    void add_map(unsigned long id, shared_ptr<maptel> m) {
+        registry_shard& shard = maptel_shard(id);
+        lock_guard<mutex> lock(shard.mtx);
+        shard.maps[id] = move(m);
+    }
+
+    // Removes the dictionary with the id from the registry. The memory is 
+    // released outside of the lock of the shard.
+    bool remove_map(unsigned long id) {
+        shared_ptr<maptel> m;
+        registry_shard& shard = maptel_shard(id);
+        lock_guard<mutex> lock(shard.mtx);
+        auto it = shard.maps.find(id);
+        if (it == shard.maps.end())
+            return false;
+        m.swap(it->second);
+        shard.maps.erase(it);
+        return true;
+    }
+
+    // Returns all the registered dictionaries.
+    vector<pair<unsigned long, shared_ptr<maptel>>> all_maps() {
+        vector<pair<unsigned long, shared_ptr<maptel>>> maps;
+        for (size_t i = 0; i != REGISTRY_SHARDS; i++) {
+            registry_shard& shard = maptel_shard(i);
+            lock_guard<mutex> lock(shard.mtx);
+            maps.insert(maps.end(), shard.maps.begin(), shard.maps.end());
+        }
+        return maps;
+    }
+
+    void clear_maps() {
+        for (size_t i = 0; i != REGISTRY_SHARDS; i++) {
+            registry_shard& shard = maptel_shard(i);
+            lock_guard<mutex> lock(shard.mtx);
+            shard.maps.clear();
+        }
     }
 
     // Validates the correctness of the number tel.
     bool valid_tel(char const *tel) {
         if (!tel) return false;
         size_t i;
-        for (i = 0; *tel != '\0' && i != TEL_NUM_MAX_LEN; i++)
+        for (i = 0; tel[i] != '\0' && i != TEL_NUM_MAX_LEN; i++)
             if (!isdigit(tel[i])) return false;
-        if (*tel != '\0') return false;
+        if (tel[i] != '\0') return false;
         if (i == 0) return false;
         return true;
     }
+
+    // Returns the number the number num is changed to in the dictionary m 
+    // or nullptr if there is no such change.
+    const char *find_change(const maptel& m, const char *num) {
+        uint64_t h = hash_of(num);
+        const shared_ptr<page>& p = m.pages[h & (m.pages.size() - 1)];
+        const entry *e = p ? p->find(num, h) : nullptr;
+        return e ? e->dst : nullptr;
+    }
+
+    // Calls f on every page of the dictionary m once, although the page 
+    // may be referenced by many slots of the directory.
+    template <typename F>
+    void for_each_page(const maptel& m, F f) {
+        for (size_t i = 0; i != m.pages.size(); i++) {
+            const page *p = m.pages[i].get();
+            if (p && i < (size_t(1) << p->depth))
+                f(*p);
+        }
+    }
+
+    // Points all the directory slots of m referencing the page of the 
+    // hash h, of the given depth, to the page p.
+    void set_page(maptel& m, uint64_t h, unsigned depth, 
+                  const shared_ptr<page>& p) {
+        size_t step = size_t(1) << depth;
+        for (size_t i = h & (step - 1); i < m.pages.size(); i += step)
+            m.pages[i] = p;
+    }
+
+    // Splits the page of the dictionary m storing the changes of numbers 
+    // with the hash h in two by the next bit of their hashes. The page 
+    // itself is left intact, as it may be shared with a clone.
+    void split_page(maptel& m, uint64_t h) {
+        shared_ptr<page> old = m.pages[h & (m.pages.size() - 1)];
+        unsigned depth = old->depth;
+        size_t size = m.pages.size();
+        if (size_t(1) << depth == size) {
+            m.pages.resize(2 * size);
+            copy(m.pages.begin(), m.pages.begin() + size, 
+                 m.pages.begin() + size);
+        }
+
+        // The halves fill up to PAGE_ENTRIES before they are split in 
+        // turn, so they are allocated for as many at once.
+        shared_ptr<page> halves[2] = {make_shared<page>(), 
+                                      make_shared<page>()};
+        for (const shared_ptr<page>& half : halves) {
+            half->depth = depth + 1;
+            half->entries.reserve(PAGE_ENTRIES);
+            half->rehash(PAGE_ENTRIES * 2);
+        }
+        for (const entry& e : old->entries) {
+            if (!e.src[0]) continue;
+            uint64_t eh = hash_of(e.src);
+            halves[eh >> depth & 1]->set(e.src, e.dst, eh);
+        }
+        uint64_t low = h & ((uint64_t(1) << depth) - 1);
+        set_page(m, low, depth + 1, halves[0]);
+        set_page(m, low | uint64_t(1) << depth, depth + 1, halves[1]);
+    }
+
+    // Returns the page of the dictionary m storing the changes of numbers 
+    // with the hash h. Copies the page first if it is shared with a clone, 
+    // which holds the only references beyond the slots of m.
+    page& writable_page(maptel& m, uint64_t h) {
+        const shared_ptr<page>& p = m.pages[h & (m.pages.size() - 1)];
+        if (!p) {
+            set_page(m, h, 0, make_shared<page>());
+        } else if (p.use_count() != long(m.pages.size() >> p->depth)) {
+            set_page(m, h, p->depth, make_shared<page>(*p));
+        } else {
+            atomic_thread_fence(memory_order_acquire);
+        }
+        return *m.pages[h & (m.pages.size() - 1)];
+    }
+
+    // Returns the bucket of the histogram for the chain of len changes.
+    size_t chain_bucket(size_t len) {
+        size_t k = 0;
+        while (len && k + 1 != MAPTEL_CHAIN_HIST_LEN) {
+            len >>= 1;
+            k++;
+        }
+        return k;
+    }
+
+    // Returns the number of bytes used by the dictionary m. Pages shared 
+    // with clones are counted in full.
+    size_t memory_usage(const maptel& m) {
+        size_t mem = sizeof(m) + m.pages.capacity() * sizeof(m.pages[0]);
+        for_each_page(m, [&mem](const page& p) { mem += p.memory(); });
+        return mem;
+    }
+
+    // Stores the change of the number src to the number dst in m.
+    void set_change(maptel& m, const char *src, const char *dst) {
+        const char *old_dst = find_change(m, src);
+        if (!old_dst || strcmp(old_dst, dst) != 0) {
+            uint64_t h = hash_of(src);
+            const page *p = m.pages[h & (m.pages.size() - 1)].get();
+            if (!old_dst && p && p->used >= PAGE_ENTRIES && 
+                p->depth < MAX_DEPTH)
+                split_page(m, h);
+            writable_page(m, h).set(src, dst, h);
+        }
+    }
+
+    // Removes the change of the number src from m. Returns false if 
+    // there was nothing to remove.
+    bool erase_change(maptel& m, const char *src) {
+        if (!find_change(m, src))
+            return false;
+        uint64_t h = hash_of(src);
+        writable_page(m, h).erase(src, h);
+        return true;
+    }
+
+
+    // Durable mode. Every mutation is appended to the log as a compact 
+    // binary record: the operation code, the ids as varints, the numbers 
+    // as length-prefixed packed BCD, and a 32-bit FNV-1a checksum. The 
+    // records are gathered in memory and written by a background thread, 
+    // so all the mutations made within WAL_COMMIT_INTERVAL share a single 
+    // fdatasync. The log starts with the generation of the snapshot it 
+    // extends, a log older than the snapshot is discarded on replay.
+    const chrono::milliseconds WAL_COMMIT_INTERVAL(2);
+    const size_t WAL_BUFFER_LIMIT = 1U << 16;
+    const char WAL_LOG_MAGIC[8] = {'M', 'A', 'P', 'T', 'E', 'L', 'W', '1'};
+    const char WAL_SNAP_MAGIC[8] = {'M', 'A', 'P', 'T', 'E', 'L', 'S', '1'};
+
+    enum wal_op : unsigned char {
+        WAL_CREATE = 1, WAL_DELETE, WAL_INSERT, WAL_ERASE, WAL_CLONE
+    };
+
+    struct wal {
+        string path;
+        int fd = -1;
+        uint64_t generation = 0;
+        mutex mtx;
+        condition_variable flush_cv;
+        condition_variable done_cv;
+        string buffer;
+        uint64_t appended = 0;      // Bytes appended to the buffer so far
+        uint64_t written = 0;       // Bytes written and synced so far
+        unsigned waiters = 0;
+        bool stop = false;
+        bool failed = false;
+        thread flusher;
+        pthread_rwlock_t gate;      // Shared by mutations, held by snapshots
+
+        wal() {
+            pthread_rwlock_init(&gate, nullptr);
+        }
+
+        ~wal() {
+            if (flusher.joinable()) {
+                {
+                    lock_guard<mutex> lock(mtx);
+                    stop = true;
+                }
+                flush_cv.notify_one();
+                flusher.join();
+            }
+            if (fd >= 0) close(fd);
+            pthread_rwlock_destroy(&gate);
+        }
+    };
+
+    // Returns the log of the durable mode, nullptr if it is turned off.
+    unique_ptr<wal>& wal_inst() {
+        static unique_ptr<wal> wal_ptr;
+        return wal_ptr;
+    }
+
+    uint32_t checksum(const char *data, size_t len) {
+        uint32_t h = 2166136261U;
+        for (size_t i = 0; i != len; i++) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 16777619U;
+        }
+        return h;
+    }
+
+    void put_fixed(string& buf, uint64_t x, size_t bytes) {
+        for (size_t i = 0; i != bytes; i++, x >>= 8)
+            buf.push_back(static_cast<char>(x & 0xFF));
+    }
+
+    void put_varint(string& buf, uint64_t x) {
+        for (; x >= 0x80; x >>= 7)
+            buf.push_back(static_cast<char>((x & 0x7F) | 0x80));
+        buf.push_back(static_cast<char>(x));
+    }
+
+    void put_number(string& buf, const char *num) {
+        size_t len = strlen(num);
+        buf.push_back(static_cast<char>(len));
+        for (size_t i = 0; i < len; i += 2) {
+            unsigned lo = num[i] - '0';
+            unsigned hi = i + 1 < len ? num[i + 1] - '0' : 0;
+            buf.push_back(static_cast<char>(lo | hi << 4));
+        }
+    }
+
+    // Sequential reader of the log and snapshot files. Every read fails 
+    // once the data is exhausted or malformed, also when pos was set 
+    // past its end.
+    struct wal_reader {
+        const string& data;
+        size_t pos;
+        bool ok;
+
+        wal_reader(const string& d, size_t p) : data(d), pos(p), ok(true) {}
+
+        uint64_t fixed(size_t bytes) {
+            uint64_t x = 0;
+            if (pos > data.size() || data.size() - pos < bytes) ok = false;
+            for (size_t i = 0; ok && i != bytes; i++)
+                x |= uint64_t(static_cast<unsigned char>(data[pos++])) << 8 * i;
+            return x;
+        }
+
+        uint64_t varint() {
+            uint64_t x = 0;
+            for (unsigned shift = 0; ok; shift += 7) {
+                if (pos >= data.size() || shift > 63) ok = false;
+                if (!ok) break;
+                unsigned char c = data[pos++];
+                x |= uint64_t(c & 0x7F) << shift;
+                if (!(c & 0x80)) break;
+            }
+            return x;
+        }
+
+        string number() {
+            string num;
+            size_t len = ok && pos < data.size() ? 
+                static_cast<unsigned char>(data[pos++]) : 0;
+            if (!len || len > TEL_NUM_MAX_LEN || 
+                data.size() - pos < (len + 1) / 2) ok = false;
+            for (size_t i = 0; ok && i != len; i++) {
+                unsigned c = static_cast<unsigned char>(data[pos + i / 2]);
+                unsigned digit = i % 2 ? c >> 4 : c & 0xF;
+                if (digit > 9) ok = false;
+                num.push_back(static_cast<char>('0' + digit));
+            }
+            if (ok) pos += (len + 1) / 2;
+            return num;
+        }
+
+        bool verify(size_t start) {
+            uint32_t sum = checksum(data.data() + start, pos - start);
+            return fixed(4) == sum && ok;
+        }
+    };
+
+    bool read_file(const string& path, string& data) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+            data.append(chunk, n);
+        close(fd);
+        return n == 0;
+    }
+
+    bool write_all(int fd, const string& data) {
+        size_t done = 0;
+        while (done != data.size()) {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    // Atomically replaces the file at path with data.
+    bool replace_file(const string& path, const string& data) {
+        string tmp = path + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        bool ok = write_all(fd, data) && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+            return false;
+
+        string dir = path.substr(0, path.find_last_of('/') + 1);
+        int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+        return true;
+    }
+
+    // Loads the dictionaries from the snapshot. A missing snapshot 
+    // is treated as an empty one of the generation 0.
+    bool load_snapshot(const string& path, uint64_t& generation) {
+        string data;
+        generation = 0;
+        if (!read_file(path, data))
+            return errno == ENOENT;
+
+        wal_reader in(data, 0);
+        if (data.compare(0, sizeof(WAL_SNAP_MAGIC), WAL_SNAP_MAGIC, 
+                         sizeof(WAL_SNAP_MAGIC)) != 0)
+            return false;
+        in.pos = sizeof(WAL_SNAP_MAGIC);
+        generation = in.fixed(8);
+        maptel_counter = in.varint();
+        for (uint64_t n = in.varint(); in.ok && n; n--) {
+            shared_ptr<maptel> m = make_shared<maptel>();
+            add_map(in.varint(), m);
+            for (uint64_t k = in.varint(); in.ok && k; k--) {
+                string src = in.number();
+                string dst = in.number();
+                if (in.ok) set_change(*m, src.c_str(), dst.c_str());
+            }
+        }
+        return in.verify(0) && in.pos == data.size();
+    }
+
+    // Applies the records of the log to the dictionaries. Returns the 
+    // length of the valid prefix of the log; a torn or corrupted record 
+    // and all the following ones are ignored.
+    size_t replay_log(const string& data) {
+        wal_reader in(data, sizeof(WAL_LOG_MAGIC) + 8);
+        size_t valid = in.pos;
+        while (in.ok && in.pos != data.size()) {
+            size_t start = in.pos;
+            unsigned op = static_cast<unsigned char>(data[in.pos++]);
+            uint64_t id = in.varint(), src_id = 0;
+            string src, dst;
+            if (op == WAL_INSERT || op == WAL_ERASE) src = in.number();
+            if (op == WAL_INSERT) dst = in.number();
+            if (op == WAL_CLONE) src_id = in.varint();
+            if (op < WAL_CREATE || op > WAL_CLONE || !in.verify(start))
+                break;
+
+            // Mutations racing with the deletion of their dictionary 
+            // may be logged after it and are skipped.
+            shared_ptr<maptel> m = find_map(op == WAL_CLONE ? src_id : id);
+            switch (op) {
+            case WAL_CREATE:
+                add_map(id, make_shared<maptel>());
+                break;
+            case WAL_DELETE:
+                remove_map(id);
+                break;
+            case WAL_INSERT:
+                if (m) set_change(*m, src.c_str(), dst.c_str());
+                break;
+            case WAL_ERASE:
+                if (m) erase_change(*m, src.c_str());
+                break;
+            case WAL_CLONE:
+                add_map(id, make_shared<maptel>());
+                if (m) find_map(id)->pages = m->pages;
+                break;
+            }
+            maptel_counter = max<uint64_t>(maptel_counter, id + 1);
+            valid = in.pos;
+        }
+        return valid;
+    }
+
+    // Creates the empty log extending the snapshot of the generation.
+    bool reset_log(wal& w, uint64_t generation) {
+        string header(WAL_LOG_MAGIC, sizeof(WAL_LOG_MAGIC));
+        put_fixed(header, generation, 8);
+        if (!replace_file(w.path + ".log", header))
+            return false;
+        int fd = open((w.path + ".log").c_str(), O_WRONLY | O_APPEND);
+        if (fd < 0)
+            return false;
+        if (w.fd >= 0) close(w.fd);
+        w.fd = fd;
+        w.generation = generation;
+        return true;
+    }
+
+    // Body of the background thread committing the buffered records.
+    void flush_loop(wal& w) {
+        unique_lock<mutex> lock(w.mtx);
+        for (;;) {
+            w.flush_cv.wait(lock, [&w] { 
+                return w.stop || !w.buffer.empty(); 
+            });
+            if (w.buffer.empty())
+                return;
+            w.flush_cv.wait_for(lock, WAL_COMMIT_INTERVAL, [&w] {
+                return w.stop || w.waiters || 
+                       w.buffer.size() >= WAL_BUFFER_LIMIT;
+            });
+
+            string batch;
+            batch.swap(w.buffer);
+            uint64_t upto = w.appended;
+            lock.unlock();
+            bool ok = write_all(w.fd, batch) && fdatasync(w.fd) == 0;
+            lock.lock();
+
+            if (!ok) w.failed = true;
+            w.written = upto;
+            w.done_cv.notify_all();
+        }
+    }
+
+    // Shares the gate of the log for the duration of a mutation, so that 
+    // snapshots see no mutation in progress. It does nothing if the 
+    // durable mode is turned off.
+    struct mutation_guard {
+        wal *w;
+
+        mutation_guard() : w(wal_inst().get()) {
+            if (w) pthread_rwlock_rdlock(&w->gate);
+        }
+
+        ~mutation_guard() {
+            if (w) pthread_rwlock_unlock(&w->gate);
+        }
+
+        mutation_guard(const mutation_guard&) = delete;
+        mutation_guard& operator =(const mutation_guard&) = delete;
+    };
+
+    // Appends the record to the log if the durable mode is turned on.
+    void wal_append(wal_op op, uint64_t id, const char *src = nullptr, 
+                    const char *dst = nullptr, uint64_t src_id = 0) {
+        wal *w = wal_inst().get();
+        if (!w) return;
+
+        lock_guard<mutex> lock(w->mtx);
+        size_t start = w->buffer.size();
+        w->buffer.push_back(static_cast<char>(op));
+        put_varint(w->buffer, id);
+        if (src) put_number(w->buffer, src);
+        if (dst) put_number(w->buffer, dst);
+        if (op == WAL_CLONE) put_varint(w->buffer, src_id);
+        put_fixed(w->buffer, checksum(w->buffer.data() + start, 
+                                      w->buffer.size() - start), 4);
+        w->appended += w->buffer.size() - start;
+
+        if (start == 0 || w->buffer.size() >= WAL_BUFFER_LIMIT)
+            w->flush_cv.notify_one();
+    }
+
+    // Waits until all the appended records are synced. 
+    bool wal_sync(wal& w) {
+        unique_lock<mutex> lock(w.mtx);
+        uint64_t target = w.appended;
+        w.waiters++;
+        w.flush_cv.notify_one();
+        w.done_cv.wait(lock, [&w, target] { 
+            return w.written >= target || w.failed; 
+        });
+        w.waiters--;
+        return !w.failed;
+    }
 } /*Anonymous namespace*/
 
 
@@ -49,25 +743,56 @@ unsigned long maptel_create() {
     if (DEBUG)
         cerr << "maptel: maptel_create()" << endl;
 
-    maptel new_maptel;
-    pair<unsigned long, maptel> new_entry = make_pair(maptel_counter, new_maptel);
-    maptel_map().insert(new_entry);
+    mutation_guard guard;
+    unsigned long new_id = maptel_counter++;
+    add_map(new_id, make_shared<maptel>());
+    wal_append(WAL_CREATE, new_id);
 
     if (DEBUG)
-        cerr << "maptel: maptel_create: new map id = " << maptel_counter << endl;
+        cerr << "maptel: maptel_create: new map id = " << new_id << endl;
 
-    return maptel_counter++;
+    return new_id;
+}
+
+
+// Creates new dictionary storing the same changes as the dictionary with 
+// the id and returns its id. Both dictionaries share the memory and copy 
+// only the parts they modify.
+unsigned long maptel_clone(unsigned long id) {
+    mutation_guard guard;
+    shared_ptr<maptel> m = find_map(id);
+    assert(m);
+
+    if (DEBUG)
+        cerr << "maptel: maptel_clone(" << id << ")" << endl;
+
+    unsigned long new_id = maptel_counter++;
+    shared_ptr<maptel> new_maptel = make_shared<maptel>();
+    {
+        lock_guard<mutex> lock(m->mtx);
+        new_maptel->pages = m->pages;
+        wal_append(WAL_CLONE, new_id, nullptr, nullptr, id);
+    }
+    add_map(new_id, move(new_maptel));
+
+    if (DEBUG)
+        cerr << "maptel: maptel_clone: new map id = " << new_id << endl;
+
+    return new_id;
 }
 
 
 // Deletes the dictionary with the id.
 void maptel_delete(unsigned long id) {
-    assert(map_exist(id));
+    mutation_guard guard;
 
     if (DEBUG)
         cerr << "maptel: maptel_delete(" << id << ")" << endl;
 
-    maptel_map().erase(id);
+    bool removed = remove_map(id);
+    assert(removed);
+    (void)removed;
+    wal_append(WAL_DELETE, id);
 
     if (DEBUG)
         cerr << "maptel: maptel_delete: map " << id << " deleted" << endl;	
@@ -79,7 +804,9 @@ void maptel_delete(unsigned long id) {
 // overwrites it.
 void maptel_insert(unsigned long id, char const *tel_src, 
                    char const *tel_dst) {
-    assert(map_exist(id));
+    mutation_guard guard;
+    shared_ptr<maptel> m = find_map(id);
+    assert(m);
     assert(valid_tel(tel_src));
     assert(valid_tel(tel_dst));
 
@@ -87,7 +814,12 @@ void maptel_insert(unsigned long id, char const *tel_src,
         cerr << "maptel: maptel_insert(" << id << ", " << tel_src << ", " 
              << tel_dst << ")" << endl;
 
-    maptel_map()[id][tel_src] = tel_dst;
+    {
+        lock_guard<mutex> lock(m->mtx);
+        m->inserts++;
+        set_change(*m, tel_src, tel_dst);
+        wal_append(WAL_INSERT, id, tel_src, tel_dst);
+    }
 
     if (DEBUG)
         cerr << "maptel: maptel_insert: inserted" << endl;
@@ -97,18 +829,26 @@ void maptel_insert(unsigned long id, char const *tel_src,
 // If there is an entry on change number tel_src stored in the dictionary
 // with the id, removes it. Otherwise, it does nothing.
 void maptel_erase(unsigned long id, char const *tel_src) {
-    assert(map_exist(id));
+    mutation_guard guard;
+    shared_ptr<maptel> m = find_map(id);
+    assert(m);
     assert(valid_tel(tel_src));
 
     if (DEBUG)
         cerr << "maptel: maptel_erase(" << id << ", " << tel_src << ")" << endl;
 
-    if (maptel_map()[id].find(tel_src) == maptel_map()[id].end()) {
+    bool erased;
+    {
+        lock_guard<mutex> lock(m->mtx);
+        m->erases++;
+        erased = erase_change(*m, tel_src);
+        if (erased) wal_append(WAL_ERASE, id, tel_src);
+    }
+    if (!erased) {
         if (DEBUG)
             cerr << "maptel: maptel_erase: nothing to erase" << endl;
         return;
     }
-    maptel_map()[id].erase(tel_src);
 
     if (DEBUG)
         cerr << "maptel: maptel_erase: erased" << endl;
@@ -122,7 +862,8 @@ void maptel_erase(unsigned long id, char const *tel_src) {
 // pointed by tel_dst.
 void maptel_transform(unsigned long id, char const *tel_src, 
                       char *tel_dst, size_t len) {
-    assert(map_exist(id));
+    shared_ptr<maptel> mp = find_map(id);
+    assert(mp);
     assert(valid_tel(tel_src));
 
     if (DEBUG)
@@ -130,41 +871,262 @@ void maptel_transform(unsigned long id, char const *tel_src,
              << ", " << static_cast<const void *>(tel_dst) << ", " 
              << len << ")" << endl;
 
-    maptel::const_iterator it1;
-    it1 = maptel_map()[id].find(tel_src);
+    maptel& m = *mp;
+    lock_guard<mutex> lock(m.mtx);
+    const char *num1, *num2;
+    size_t chain = 0;
+    bool cycle = false;
+    num1 = find_change(m, tel_src);
 
-    if (it1 == maptel_map()[id].end()) {
+    if (!num1) {
         assert(len > strlen(tel_src));
         strncpy(tel_dst, tel_src, len);
     }
     else {
-        const char *last_num = it1->second.c_str();
-        maptel::const_iterator it2 = maptel_map()[id].find(it1->second);
-
-        while (it2 != maptel_map()[id].end() && it1 != it2) {
-            it1 = maptel_map()[id].find(it1->second);
-            last_num = it2->second.c_str();
-            it2 = maptel_map()[id].find(it2->second);
-            if (it2 != maptel_map()[id].end()) {
-                if(it1 == it2) break;
-                last_num = it2->second.c_str();
-                it2 = maptel_map()[id].find(it2->second);
+        const char *last_num = num1;
+        num2 = find_change(m, num1);
+        chain++;
+
+        while (num2 && num1 != num2) {
+            num1 = find_change(m, num1);
+            last_num = num2;
+            num2 = find_change(m, num2);
+            chain++;
+            if (num2) {
+                if(num1 == num2) break;
+                last_num = num2;
+                num2 = find_change(m, num2);
+                chain++;
             }
         }
 
-        if (it2 == maptel_map()[id].end()) {
+        if (!num2) {
             assert(len > strlen(last_num));
             strncpy(tel_dst, last_num, len);
         }
         else {
             if(DEBUG)
                 cerr << "maptel: maptel_transform: cycle detected" << endl;
+            cycle = true;
             assert(len > strlen(tel_src));
             strncpy(tel_dst, tel_src, len);
         }
     }
 
+    m.transforms++;
+    m.chain_hist[chain_bucket(chain)]++;
+    if (cycle) m.cycles++;
+
     if (DEBUG)
         cerr << "maptel: maptel_transform: " << tel_src << " -> " << tel_dst 
              << "," << endl;
 }
+
+
+// Saves into stats the statistics of the dictionary with the id.
+void maptel_stats(unsigned long id, struct maptel_statistics *stats) {
+    shared_ptr<maptel> mp = find_map(id);
+    assert(mp);
+    assert(stats);
+
+    if (DEBUG)
+        cerr << "maptel: maptel_stats(" << id << ", " 
+             << static_cast<const void *>(stats) << ")" << endl;
+
+    maptel& m = *mp;
+    lock_guard<mutex> lock(m.mtx);
+    size_t slots = 0, capacity = 0;
+    stats->entries = 0;
+    for_each_page(m, [&](const page& p) {
+        stats->entries += p.used;
+        slots += p.slots.size();
+        capacity += p.entries.capacity();
+    });
+    stats->inserts = m.inserts;
+    stats->erases = m.erases;
+    stats->transforms = m.transforms;
+    for (size_t k = 0; k != MAPTEL_CHAIN_HIST_LEN; k++)
+        stats->chain_hist[k] = m.chain_hist[k];
+    stats->cycles = m.cycles;
+    stats->load_factor = slots ? double(stats->entries) / slots : 0.0;
+    stats->memory = memory_usage(m);
+    stats->fragmentation = 
+        capacity ? double(capacity - stats->entries) / capacity : 0.0;
+    stats->bytes_per_entry = 
+        stats->entries ? double(stats->memory) / stats->entries : 0.0;
+
+    if (DEBUG)
+        cerr << "maptel: maptel_stats: " << stats->entries << " entries, " 
+             << stats->memory << " bytes" << endl;
+}
+
+
+// Saves into ids the ids of at most len existing dictionaries, in no 
+// particular order, and returns the number of all of them.
+size_t maptel_list(unsigned long *ids, size_t len) {
+    assert(ids || !len);
+
+    if (DEBUG)
+        cerr << "maptel: maptel_list(" << static_cast<const void *>(ids) 
+             << ", " << len << ")" << endl;
+
+    vector<pair<unsigned long, shared_ptr<maptel>>> maps = all_maps();
+    for (size_t i = 0; i != maps.size() && i != len; i++)
+        ids[i] = maps[i].first;
+
+    if (DEBUG)
+        cerr << "maptel: maptel_list: " << maps.size() << " maps" << endl;
+
+    return maps.size();
+}
+
+
+// Turns on the durable mode. Restores the dictionaries from the snapshot 
+// path.snap and the log path.log, then appends every mutation to the log.
+int maptel_durable_open(char const *path) {
+    assert(path);
+    assert(!wal_inst());
+    assert(all_maps().empty());
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_open(" << path << ")" << endl;
+
+    unique_ptr<wal> w(new wal);
+    w->path = path;
+    string log;
+    uint64_t generation;
+    bool ok = load_snapshot(w->path + ".snap", generation);
+
+    if (ok && read_file(w->path + ".log", log)) {
+        wal_reader in(log, sizeof(WAL_LOG_MAGIC));
+        uint64_t log_generation = in.fixed(8);
+        ok = in.ok && log_generation <= generation && 
+             log.compare(0, sizeof(WAL_LOG_MAGIC), WAL_LOG_MAGIC, 
+                         sizeof(WAL_LOG_MAGIC)) == 0;
+        if (ok && log_generation == generation) {
+            size_t valid = replay_log(log);
+            w->fd = open((w->path + ".log").c_str(), O_WRONLY | O_APPEND);
+            w->generation = generation;
+            ok = w->fd >= 0 && 
+                 (valid == log.size() || ftruncate(w->fd, valid) == 0);
+        }
+        else if (ok) {
+            ok = reset_log(*w, generation);
+        }
+    }
+    else if (ok) {
+        ok = errno == ENOENT && reset_log(*w, generation);
+    }
+
+    if (!ok) {
+        clear_maps();
+        maptel_counter = 0UL;
+        if (DEBUG)
+            cerr << "maptel: maptel_durable_open: cannot restore" << endl;
+        return -1;
+    }
+    w->flusher = thread(flush_loop, ref(*w));
+    wal_inst() = move(w);
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_open: " << all_maps().size() 
+             << " maps restored" << endl;
+
+    return 0;
+}
+
+
+// Waits until all the mutations made so far are stored on the disk.
+int maptel_durable_sync() {
+    assert(wal_inst());
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_sync()" << endl;
+
+    if (!wal_sync(*wal_inst())) {
+        if (DEBUG)
+            cerr << "maptel: maptel_durable_sync: write failed" << endl;
+        return -1;
+    }
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_sync: synced" << endl;
+
+    return 0;
+}
+
+
+// Writes all the dictionaries into a new snapshot and empties the log.
+int maptel_durable_snapshot() {
+    assert(wal_inst());
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_snapshot()" << endl;
+
+    // Holding the gate exclusively waits for the mutations in progress 
+    // and keeps out the new ones until the log is replaced.
+    wal& w = *wal_inst();
+    pthread_rwlock_wrlock(&w.gate);
+    if (!wal_sync(w)) {
+        pthread_rwlock_unlock(&w.gate);
+        return -1;
+    }
+
+    vector<pair<unsigned long, shared_ptr<maptel>>> maps = all_maps();
+    string data(WAL_SNAP_MAGIC, sizeof(WAL_SNAP_MAGIC));
+    put_fixed(data, w.generation + 1, 8);
+    put_varint(data, maptel_counter);
+    put_varint(data, maps.size());
+    for (const pair<unsigned long, shared_ptr<maptel>>& d : maps) {
+        lock_guard<mutex> map_lock(d.second->mtx);
+        size_t entries = 0;
+        for_each_page(*d.second, [&entries](const page& p) {
+            entries += p.used;
+        });
+        put_varint(data, d.first);
+        put_varint(data, entries);
+        for_each_page(*d.second, [&data](const page& p) {
+            for (const entry& e : p.entries) {
+                if (!e.src[0]) continue;
+                put_number(data, e.src);
+                put_number(data, e.dst);
+            }
+        });
+    }
+    put_fixed(data, checksum(data.data(), data.size()), 4);
+
+    unique_lock<mutex> lock(w.mtx);
+    bool ok = replace_file(w.path + ".snap", data) && 
+              reset_log(w, w.generation + 1);
+    lock.unlock();
+    pthread_rwlock_unlock(&w.gate);
+
+    if (!ok) {
+        if (DEBUG)
+            cerr << "maptel: maptel_durable_snapshot: write failed" << endl;
+        return -1;
+    }
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_snapshot: " << data.size() 
+             << " bytes written" << endl;
+
+    return 0;
+}
+
+
+// Syncs the log and turns off the durable mode.
+int maptel_durable_close() {
+    assert(wal_inst());
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_close()" << endl;
+
+    bool ok = wal_sync(*wal_inst());
+    wal_inst().reset();
+
+    if (DEBUG)
+        cerr << "maptel: maptel_durable_close: closed" << endl;
+
+    return ok ? 0 : -1;
+}
@@ -2,13 +2,44 @@
 #define MAPTEL_H
 #include <stddef.h>
 
+#ifdef __cplusplus
+static const size_t MAPTEL_CHAIN_HIST_LEN = 8U;
+#else /* __cplusplus */
+#define MAPTEL_CHAIN_HIST_LEN ((size_t)8U)
+#endif /* __cplusplus */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// All the functions may be called concurrently from many threads, except 
+// for maptel_durable_open and maptel_durable_close.
+
+// Statistics of the dictionary gathered since its creation. The bucket 0 
+// of chain_hist counts transformations of numbers without any change, the 
+// bucket k > 0 counts chains of 2^(k-1) to 2^k - 1 changes walked. The last 
+// bucket counts also all the longer chains.
+struct maptel_statistics {
+    size_t entries;             // Number of stored changes
+    unsigned long inserts;      // Number of calls to maptel_insert
+    unsigned long erases;       // Number of calls to maptel_erase
+    unsigned long transforms;   // Number of calls to maptel_transform
+    unsigned long chain_hist[MAPTEL_CHAIN_HIST_LEN];
+    unsigned long cycles;       // Number of cycles detected
+    double load_factor;         // Fraction of occupied hash table slots
+    size_t memory;              // Number of bytes in use
+    double fragmentation;       // Fraction of allocated entries not in use
+    double bytes_per_entry;     // Memory per stored change
+};
+
 // Creates new dictionary and returns a natural number being its id.
 unsigned long maptel_create();
 
+// Creates new dictionary storing the same changes as the dictionary with 
+// the id and returns its id. Both dictionaries share the memory and copy 
+// only the parts they modify.
+unsigned long maptel_clone(unsigned long id);
+
 // Deletes the dictionary with the id.
 void maptel_delete(unsigned long id);
 
@@ -29,6 +60,32 @@ void maptel_erase(unsigned long id, char const *tel_src);
 void maptel_transform(unsigned long id, char const *tel_src, 
                       char *tel_dst, size_t len);
 
+// Saves into stats the statistics of the dictionary with the id.
+void maptel_stats(unsigned long id, struct maptel_statistics *stats);
+
+// Saves into ids the ids of at most len existing dictionaries, in no 
+// particular order, and returns the number of all of them.
+size_t maptel_list(unsigned long *ids, size_t len);
+
+// Turns on the durable mode. Restores the dictionaries from the snapshot 
+// path.snap and the log path.log, then appends every mutation to the log. 
+// Mutations are synced in groups within a few milliseconds. It has to be 
+// called before any dictionary is created. Returns 0 on success and -1 
+// if the files cannot be read or created.
+int maptel_durable_open(char const *path);
+
+// Waits until all the mutations made so far are stored on the disk. 
+// Returns 0 on success and -1 if writing the log failed.
+int maptel_durable_sync();
+
+// Writes all the dictionaries into a new snapshot and empties the log. 
+// Returns 0 on success and -1 on failure.
+int maptel_durable_snapshot();
+
+// Syncs the log and turns off the durable mode. The dictionaries stay 
+// in memory. Returns 0 on success and -1 if writing the log failed.
+int maptel_durable_close();
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,203 @@
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "maptel_client.h"
+#include "maptel_protocol.h"
+
+using namespace std;
+using namespace maptel_protocol;
+
+// Requests are gathered in out and sent once it reaches SEND_BATCH bytes 
+// or a response is needed. Responses to the queued requests are read 
+// lazily, but at most MAX_PENDING of them are left unread, so that the 
+// daemon never stops reading because of a full output.
+struct maptel_client {
+    int fd;
+    string out;
+    string in;
+    size_t pending = 0;     // Requests sent or queued, not answered yet
+    int failed = 0;         // Requests failed since the last flush
+    bool broken = false;
+};
+
+namespace {
+    const size_t SEND_BATCH = 1U << 12;
+    const size_t MAX_PENDING = 1U << 12;
+
+    bool send_queued(maptel_client *c) {
+        size_t done = 0;
+        while (!c->broken && done != c->out.size()) {
+            ssize_t n = send(c->fd, c->out.data() + done, 
+                             c->out.size() - done, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) c->broken = true;
+            else done += n;
+        }
+        c->out.clear();
+        return !c->broken;
+    }
+
+    // Reads the next response into body. Returns false if the connection 
+    // is broken.
+    bool receive(maptel_client *c, string& body) {
+        char chunk[1 << 12];
+        for (;;) {
+            if (c->in.size() >= 4) {
+                reader header(c->in.data(), 4);
+                size_t len = static_cast<size_t>(header.fixed(4));
+                if (len == 0 || len > MAX_FRAME) {
+                    c->broken = true;
+                    return false;
+                }
+                if (c->in.size() - 4 >= len) {
+                    body.assign(c->in, 4, len);
+                    c->in.erase(0, 4 + len);
+                    c->pending--;
+                    return true;
+                }
+            }
+            ssize_t n = c->broken ? -1 : read(c->fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                c->broken = true;
+                return false;
+            }
+            c->in.append(chunk, n);
+        }
+    }
+
+    // Sends the queued requests and reads responses until only left 
+    // of them are pending.
+    bool collect(maptel_client *c, size_t left) {
+        string body;
+        if (!send_queued(c))
+            return false;
+        while (c->pending > left) {
+            if (!receive(c, body))
+                return false;
+            if (body[0] != STATUS_OK)
+                c->failed++;
+        }
+        return true;
+    }
+
+    void enqueue(maptel_client *c, const string& body) {
+        put_frame(c->out, body);
+        c->pending++;
+        if (c->pending > MAX_PENDING)
+            collect(c, MAX_PENDING / 2);
+        else if (c->out.size() >= SEND_BATCH)
+            send_queued(c);
+    }
+
+    // Queues the request, waits for its response and saves it into body. 
+    // Returns false if the request failed.
+    bool call(maptel_client *c, const string& request, string& body) {
+        put_frame(c->out, request);
+        c->pending++;
+        return collect(c, 1) && receive(c, body) && body[0] == STATUS_OK;
+    }
+}
+
+
+// Connects to the daemon listening on the Unix domain socket at the path.
+maptel_client *maptel_client_connect(char const *path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (!path || strlen(path) >= sizeof(addr.sun_path))
+        return nullptr;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return nullptr;
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    maptel_client *c = new maptel_client;
+    c->fd = fd;
+    return c;
+}
+
+
+// Sends the queued requests and closes the connection.
+void maptel_client_close(maptel_client *c) {
+    if (!c) return;
+    collect(c, 0);
+    close(c->fd);
+    delete c;
+}
+
+
+// Creates new dictionary and saves its id into id.
+int maptel_client_create(maptel_client *c, unsigned long *id) {
+    string request(1, static_cast<char>(OP_CREATE)), body;
+    if (!call(c, request, body))
+        return -1;
+    reader in(body.data() + 1, body.size() - 1);
+    *id = static_cast<unsigned long>(in.fixed(8));
+    return in.ok ? 0 : -1;
+}
+
+
+// Deletes the dictionary with the id.
+void maptel_client_delete(maptel_client *c, unsigned long id) {
+    string request(1, static_cast<char>(OP_DELETE));
+    put_u64(request, id);
+    enqueue(c, request);
+}
+
+
+// Inserts into the dictionary with the id a new entry on change the number
+// tel_src to the number tel_dst.
+void maptel_client_insert(maptel_client *c, unsigned long id, 
+                          char const *tel_src, char const *tel_dst) {
+    string request(1, static_cast<char>(OP_INSERT));
+    put_u64(request, id);
+    put_number(request, tel_src);
+    put_number(request, tel_dst);
+    enqueue(c, request);
+}
+
+
+// Removes the entry on change number tel_src from the dictionary with the id.
+void maptel_client_erase(maptel_client *c, unsigned long id, 
+                         char const *tel_src) {
+    string request(1, static_cast<char>(OP_ERASE));
+    put_u64(request, id);
+    put_number(request, tel_src);
+    enqueue(c, request);
+}
+
+
+// Follows the sequence of changes of the number tel_src.
+int maptel_client_transform(maptel_client *c, unsigned long id, 
+                            char const *tel_src, char *tel_dst, size_t len) {
+    string request(1, static_cast<char>(OP_TRANSFORM)), body;
+    put_u64(request, id);
+    put_number(request, tel_src);
+    if (!call(c, request, body))
+        return -1;
+
+    char num[MAX_NUMBER + 1];
+    reader in(body.data() + 1, body.size() - 1);
+    if (!in.number(num) || strlen(num) >= len)
+        return -1;
+    strcpy(tel_dst, num);
+    return 0;
+}
+
+
+// Sends the queued requests and waits for their completion.
+int maptel_client_flush(maptel_client *c) {
+    if (!collect(c, 0))
+        return -1;
+    int failed = c->failed;
+    c->failed = 0;
+    return failed;
+}
@@ -0,0 +1,56 @@
+#ifndef MAPTEL_CLIENT_H
+#define MAPTEL_CLIENT_H
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Connection to the maptel daemon. A connection must not be used by 
+// many threads at once.
+struct maptel_client;
+
+// Connects to the daemon listening on the Unix domain socket at the path. 
+// Returns NULL on failure.
+struct maptel_client *maptel_client_connect(char const *path);
+
+// Sends the queued requests and closes the connection.
+void maptel_client_close(struct maptel_client *client);
+
+// Creates new dictionary and saves its id into id. Returns 0 on success 
+// and -1 on failure.
+int maptel_client_create(struct maptel_client *client, unsigned long *id);
+
+// The following requests are queued and sent in batches without waiting 
+// for each other. Their failures are reported by maptel_client_flush.
+
+// Deletes the dictionary with the id.
+void maptel_client_delete(struct maptel_client *client, unsigned long id);
+
+// Inserts into the dictionary with the id a new entry on change the number
+// tel_src to the number tel_dst. If any appropriate entry already exists, 
+// overwrites it.
+void maptel_client_insert(struct maptel_client *client, unsigned long id, 
+                          char const *tel_src, char const *tel_dst);
+
+// If there is an entry on change number tel_src stored in the dictionary
+// with the id, removes it. Otherwise, it does nothing.
+void maptel_client_erase(struct maptel_client *client, unsigned long id, 
+                         char const *tel_src);
+
+// Follows the sequence of changes of the number tel_src like 
+// maptel_transform, after all the queued requests are executed. Returns 
+// 0 on success and -1 on failure.
+int maptel_client_transform(struct maptel_client *client, unsigned long id, 
+                            char const *tel_src, char *tel_dst, size_t len);
+
+// Sends the queued requests and waits for their completion. Returns the 
+// number of requests failed since the last flush or -1 if the connection 
+// is broken.
+int maptel_client_flush(struct maptel_client *client);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MAPTEL_CLIENT_H */
@@ -0,0 +1,108 @@
+#ifndef MAPTEL_PROTOCOL_H
+#define MAPTEL_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Binary protocol of the maptel daemon. Every request and response is 
+// a frame: the length of its body (4 bytes, little endian) followed by 
+// the body. A request body starts with the operation code, a response 
+// body with the status. Ids take 8 bytes, little endian; numbers are 
+// a length byte followed by the ASCII digits. Requests sent over one 
+// connection are answered in order, so clients may pipeline them and 
+// send whole batches in a single write.
+namespace maptel_protocol {
+    enum op : unsigned char {
+        OP_CREATE = 1,      // -> id
+        OP_DELETE,          // id ->
+        OP_INSERT,          // id, tel_src, tel_dst ->
+        OP_ERASE,           // id, tel_src ->
+        OP_TRANSFORM        // id, tel_src -> tel_dst
+    };
+
+    enum status : unsigned char {
+        STATUS_OK = 0,
+        STATUS_NO_MAP,      // There is no dictionary with the id
+        STATUS_BAD_NUMBER,  // The number is not a valid phone number
+        STATUS_BAD_REQUEST  // The frame is malformed
+    };
+
+    // Upper bound on the length of a frame body.
+    const size_t MAX_FRAME = 64U;
+    const size_t MAX_NUMBER = 22U;
+
+    inline void put_u32(std::string& buf, uint32_t x) {
+        for (int i = 0; i != 4; i++, x >>= 8)
+            buf.push_back(static_cast<char>(x & 0xFF));
+    }
+
+    inline void put_u64(std::string& buf, uint64_t x) {
+        for (int i = 0; i != 8; i++, x >>= 8)
+            buf.push_back(static_cast<char>(x & 0xFF));
+    }
+
+    // Appends the number. A number longer than MAX_NUMBER chars is 
+    // invalid anyway, so at most MAX_NUMBER + 1 of its chars are sent, 
+    // enough for the receiver to reject it, and the frame stays below 
+    // MAX_FRAME.
+    inline void put_number(std::string& buf, const char *num) {
+        size_t len = 0;
+        while (len <= MAX_NUMBER && num[len] != '\0')
+            len++;
+        buf.push_back(static_cast<char>(len));
+        buf.append(num, len);
+    }
+
+    // Appends the frame with the body to the buffer.
+    inline void put_frame(std::string& buf, const std::string& body) {
+        put_u32(buf, static_cast<uint32_t>(body.size()));
+        buf += body;
+    }
+
+    // Sequential reader of a frame body. Every read fails once the body 
+    // is exhausted or malformed.
+    struct reader {
+        const char *pos;
+        const char *end;
+        bool ok;
+
+        reader(const char *data, size_t len) : 
+            pos(data), end(data + len), ok(true) {}
+
+        uint64_t fixed(size_t bytes) {
+            uint64_t x = 0;
+            if (static_cast<size_t>(end - pos) < bytes) ok = false;
+            for (size_t i = 0; ok && i != bytes; i++)
+                x |= uint64_t(static_cast<unsigned char>(*pos++)) << 8 * i;
+            return x;
+        }
+
+        // Reads a number into the buffer num of MAX_NUMBER + 1 chars. 
+        // Returns false if it is not a valid phone number, i.e. it is 
+        // empty, too long or has a non-digit character.
+        bool number(char *num) {
+            if (!ok || pos == end) {
+                ok = false;
+                return false;
+            }
+            size_t len = static_cast<unsigned char>(*pos++);
+            if (static_cast<size_t>(end - pos) < len) {
+                ok = false;
+                return false;
+            }
+            bool valid = len != 0 && len <= MAX_NUMBER;
+            for (size_t i = 0; valid && i != len; i++)
+                if (pos[i] < '0' || pos[i] > '9') valid = false;
+            if (valid) {
+                std::memcpy(num, pos, len);
+                num[len] = '\0';
+            }
+            pos += len;
+            return valid;
+        }
+    };
+}
+
+#endif /* MAPTEL_PROTOCOL_H */
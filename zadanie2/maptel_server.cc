@@ -0,0 +1,378 @@
+// Local maptel daemon. Serves the dictionaries of the maptel module to 
+// many processes over a Unix domain socket, see maptel_protocol.h for 
+// the protocol. Every thread runs its own event loop and owns the 
+// connections it has accepted; the dictionaries are shared by all. 
+// In the durable mode the log is compacted into a snapshot whenever 
+// it grows past snapshot_bytes (64 MiB by default).
+//
+// g++ -O2 -std=c++11 -DNDEBUG maptel.cc maptel_server.cc -o maptel_server -pthread
+// ./maptel_server socket_path [threads [durable_path [snapshot_bytes]]]
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "maptel.h"
+#include "maptel_protocol.h"
+
+using namespace std;
+using namespace maptel_protocol;
+
+namespace {
+    const size_t ID_SHARDS = 64U;
+    const int MAX_EVENTS = 64;
+    const size_t READ_CHUNK = 1U << 16;
+
+    // Responses queued for a connection above which its requests are not 
+    // read until the client catches up.
+    const size_t OUTPUT_LIMIT = 1U << 20;
+
+    // Unprocessed requests buffered for a connection above which no more 
+    // are read, and bytes read from a connection per wakeup, so that a 
+    // busy client does not starve the others of its event loop.
+    const size_t INPUT_LIMIT = 1U << 20;
+    const size_t READ_BUDGET = 4 * READ_CHUNK;
+
+    // Size of the log of the durable mode above which the dictionaries 
+    // are written into a snapshot and the log is emptied, by default, 
+    // and the interval (in ms) of checking it.
+    const unsigned long SNAPSHOT_LOG_SIZE = 64UL << 20;
+    const int SNAPSHOT_INTERVAL = 1000;
+
+    // Ids of the dictionaries created through the daemon or restored 
+    // from its durable files. The maptel module asserts that the ids are 
+    // valid, while the daemon has to reject requests of misbehaving 
+    // clients. A request holds the lock of its id shared, a deletion 
+    // holds it exclusively.
+    struct id_shard {
+        pthread_rwlock_t lock;
+        unordered_set<unsigned long> ids;
+
+        id_shard() {
+            pthread_rwlock_init(&lock, nullptr);
+        }
+    };
+
+    id_shard& shard_of(unsigned long id) {
+        static id_shard shards[ID_SHARDS];
+        return shards[id % ID_SHARDS];
+    }
+
+    // Signalled on SIGINT and SIGTERM, wakes up all the event loops.
+    int stop_fd = -1;
+
+    void on_signal(int) {
+        uint64_t one = 1;
+        ssize_t ignored = write(stop_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    struct connection {
+        int fd;
+        string in;
+        string out;
+        size_t out_pos = 0;
+        uint32_t events = 0;
+    };
+
+    // Executes the request with the body and appends the response to out. 
+    // Returns false if the request is malformed.
+    bool handle(const char *body, size_t len, string& out) {
+        reader in(body, len);
+        unsigned op = static_cast<unsigned>(in.fixed(1));
+        string resp;
+
+        if (op == OP_CREATE) {
+            if (!in.ok || in.pos != in.end)
+                return false;
+            unsigned long id = maptel_create();
+            id_shard& shard = shard_of(id);
+            pthread_rwlock_wrlock(&shard.lock);
+            shard.ids.insert(id);
+            pthread_rwlock_unlock(&shard.lock);
+            resp.push_back(STATUS_OK);
+            put_u64(resp, id);
+            put_frame(out, resp);
+            return true;
+        }
+
+        char src[MAX_NUMBER + 1], dst[MAX_NUMBER + 1];
+        unsigned long id = static_cast<unsigned long>(in.fixed(8));
+        bool valid = true;
+        if (op == OP_INSERT || op == OP_ERASE || op == OP_TRANSFORM)
+            valid = in.number(src);
+        if (op == OP_INSERT)
+            valid = in.number(dst) && valid;
+        if (!in.ok || in.pos != in.end || op < OP_DELETE || op > OP_TRANSFORM)
+            return false;
+
+        id_shard& shard = shard_of(id);
+        status st = valid ? STATUS_OK : STATUS_BAD_NUMBER;
+        if (st == STATUS_OK && op == OP_DELETE) {
+            pthread_rwlock_wrlock(&shard.lock);
+            if (shard.ids.erase(id))
+                maptel_delete(id);
+            else
+                st = STATUS_NO_MAP;
+            pthread_rwlock_unlock(&shard.lock);
+        }
+        else if (st == STATUS_OK) {
+            pthread_rwlock_rdlock(&shard.lock);
+            if (!shard.ids.count(id))
+                st = STATUS_NO_MAP;
+            else if (op == OP_INSERT)
+                maptel_insert(id, src, dst);
+            else if (op == OP_ERASE)
+                maptel_erase(id, src);
+            else
+                maptel_transform(id, src, dst, sizeof(dst));
+            pthread_rwlock_unlock(&shard.lock);
+        }
+
+        resp.push_back(static_cast<char>(st));
+        if (op == OP_TRANSFORM && st == STATUS_OK)
+            put_number(resp, dst);
+        put_frame(out, resp);
+        return true;
+    }
+
+    // Executes the complete requests read from the connection while its 
+    // output is below the limit. Returns false if a request is malformed.
+    bool process(connection& c) {
+        size_t pos = 0;
+        while (c.out.size() - c.out_pos < OUTPUT_LIMIT && 
+               c.in.size() - pos >= 4) {
+            reader header(c.in.data() + pos, 4);
+            size_t len = static_cast<size_t>(header.fixed(4));
+            if (len == 0 || len > MAX_FRAME)
+                return false;
+            if (c.in.size() - pos - 4 < len)
+                break;
+            if (!handle(c.in.data() + pos + 4, len, c.out))
+                return false;
+            pos += 4 + len;
+        }
+        c.in.erase(0, pos);
+        return true;
+    }
+
+    // Writes as much of the output of the connection as the socket takes. 
+    // Returns false if the connection is broken.
+    bool flush(connection& c) {
+        while (c.out_pos != c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.out_pos, 
+                             c.out.size() - c.out_pos, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n < 0) return false;
+            c.out_pos += n;
+        }
+        if (c.out_pos == c.out.size()) {
+            c.out.clear();
+            c.out_pos = 0;
+        }
+        return true;
+    }
+
+    // Whether reading from the connection has to wait for its client.
+    bool backlogged(const connection& c) {
+        return c.out.size() - c.out_pos >= OUTPUT_LIMIT || 
+               c.in.size() >= INPUT_LIMIT;
+    }
+
+    // Reads the available requests, up to READ_BUDGET bytes, executes them 
+    // and sends the responses. The rest is left to the next wakeup of the 
+    // level-triggered loop. Returns false if the connection should be 
+    // closed.
+    bool pump(int epoll_fd, connection& c, uint32_t events) {
+        bool eof = false;
+        if (events & EPOLLIN) {
+            char chunk[READ_CHUNK];
+            size_t budget = READ_BUDGET;
+            while (budget && !backlogged(c)) {
+                ssize_t n = read(c.fd, chunk, min(sizeof(chunk), budget));
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                if (n <= 0) {
+                    eof = true;
+                    break;
+                }
+                budget -= n;
+                c.in.append(chunk, n);
+                if (!process(c) || !flush(c))
+                    return false;
+            }
+        }
+        if (!process(c) || !flush(c))
+            return false;
+        if (eof || (events & (EPOLLERR | EPOLLHUP)))
+            return false;
+
+        uint32_t wanted = 0;
+        if (!backlogged(c)) wanted |= EPOLLIN;
+        if (c.out_pos != c.out.size()) wanted |= EPOLLOUT;
+        if (wanted != c.events) {
+            epoll_event ev = {};
+            ev.events = wanted;
+            ev.data.fd = c.fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev) != 0)
+                return false;
+            c.events = wanted;
+        }
+        return true;
+    }
+
+    // Writes a snapshot whenever the log at the path grows past limit 
+    // bytes, so that it does not grow without bound and a restart does 
+    // not replay all of it. Returns once stop_fd is signalled.
+    void snapshot_loop(const string& log_path, unsigned long limit) {
+        pollfd stop = {};
+        stop.fd = stop_fd;
+        stop.events = POLLIN;
+        for (;;) {
+            int n = poll(&stop, 1, SNAPSHOT_INTERVAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n != 0) return;
+
+            struct stat st;
+            if (stat(log_path.c_str(), &st) == 0 && 
+                static_cast<unsigned long>(st.st_size) >= limit && 
+                maptel_durable_snapshot() != 0)
+                cerr << "maptel_server: cannot write a snapshot" << endl;
+        }
+    }
+
+    // Event loop of a single thread. The listening socket is watched with 
+    // EPOLLEXCLUSIVE, so every new connection wakes up just one loop.
+    void serve(int listen_fd, unsigned cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = listen_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = stop_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+
+        unordered_map<int, connection> conns;
+        epoll_event events[MAX_EVENTS];
+        bool stop = false;
+        while (!stop) {
+            int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;
+
+            for (int i = 0; i != n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == stop_fd) {
+                    stop = true;
+                }
+                else if (fd == listen_fd) {
+                    int conn_fd;
+                    while ((conn_fd = accept4(listen_fd, nullptr, nullptr, 
+                                SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                        connection& c = conns[conn_fd];
+                        c.fd = conn_fd;
+                        c.events = EPOLLIN;
+                        ev.events = EPOLLIN;
+                        ev.data.fd = conn_fd;
+                        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn_fd, &ev);
+                    }
+                }
+                else if (!pump(epoll_fd, conns[fd], events[i].events)) {
+                    close(fd);
+                    conns.erase(fd);
+                }
+            }
+        }
+
+        for (const pair<const int, connection>& c : conns)
+            close(c.first);
+        close(epoll_fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 5) {
+        cerr << "usage: " << argv[0] 
+             << " socket_path [threads [durable_path [snapshot_bytes]]]" 
+             << endl;
+        return 1;
+    }
+
+    string path = argv[1];
+    unsigned cores = max(thread::hardware_concurrency(), 1U);
+    unsigned threads = argc > 2 ? strtoul(argv[2], nullptr, 10) : cores;
+    if (threads == 0) threads = cores;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << "maptel_server: socket path too long" << endl;
+        return 1;
+    }
+    path.copy(addr.sun_path, path.size());
+
+    if (argc > 3 && maptel_durable_open(argv[3]) != 0) {
+        cerr << "maptel_server: cannot open " << argv[3] << endl;
+        return 1;
+    }
+
+    // The restored dictionaries are served like the created ones.
+    vector<unsigned long> restored(maptel_list(nullptr, 0));
+    restored.resize(maptel_list(restored.data(), restored.size()));
+    for (unsigned long id : restored)
+        shard_of(id).ids.insert(id);
+
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (listen_fd < 0 || 
+        bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || 
+        listen(listen_fd, SOMAXCONN) != 0) {
+        cerr << "maptel_server: cannot listen on " << path << endl;
+        return 1;
+    }
+
+    vector<thread> loops;
+    for (unsigned i = 0; i != threads; i++)
+        loops.emplace_back(serve, listen_fd, i % cores);
+    if (argc > 3) {
+        unsigned long limit = argc > 4 ? strtoul(argv[4], nullptr, 10) 
+                                       : SNAPSHOT_LOG_SIZE;
+        loops.emplace_back(snapshot_loop, string(argv[3]) + ".log", limit);
+    }
+    for (thread& t : loops)
+        t.join();
+
+    close(listen_fd);
+    unlink(path.c_str());
+    if (argc > 3)
+        maptel_durable_close();
+    return 0;
+}
@@ -0,0 +1,245 @@
+// Benchmarks of the maptel module. Reports throughput and latency 
+// percentiles of bulk inserts (through both maptel.h from C and cmaptel 
+// from C++), random erases, transforms of chains with configurable 
+// lengths and cycles, churn of many short-lived dictionaries, clones 
+// of a large dictionary followed by scattered writes, and mutations in 
+// the durable mode.
+//
+// gcc -c -O2 maptel_bench_c.c -o maptel_bench_c.o
+// g++ -O2 -std=c++11 -DNDEBUG ../maptel.cc maptel_bench.cc 
+//     maptel_bench_c.o -o maptel_bench -pthread
+// ./maptel_bench [-n ops] [-c max_chain] [-y cycle_percent] [-k dict_size] 
+//                [-t threads] [-l log_path]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "../cmaptel"
+
+extern "C" void maptel_bench_c_insert(unsigned long id, unsigned long seed, 
+                                      size_t n, unsigned long long *lat);
+
+using namespace std;
+
+namespace {
+    typedef chrono::steady_clock bench_clock;
+    typedef vector<unsigned long long> latencies;
+
+    struct options {
+        size_t ops = 1000000;
+        size_t max_chain = 8;       // Chains have 1 to max_chain changes
+        unsigned cycle_percent = 10;
+        size_t dict_size = 16;      // Changes per dictionary in the churn
+        unsigned threads = 1;
+        string log_path = "/tmp/maptel_bench";
+    };
+
+    unsigned long long elapsed_ns(bench_clock::time_point start) {
+        return chrono::duration_cast<chrono::nanoseconds>(
+            bench_clock::now() - start).count();
+    }
+
+    void report(const char *name, latencies& lat, double secs) {
+        sort(lat.begin(), lat.end());
+        size_t n = lat.size();
+        printf("%-16s %10zu ops %12.0f ops/s  p50 %7llu ns  p99 %7llu ns\n", 
+               name, n, n / secs, lat[n / 2], lat[n * 99 / 100]);
+    }
+
+    string number(unsigned long x) {
+        return to_string(x);
+    }
+
+    // Inserts ops changes through cmaptel and through maptel.h from C.
+    void bench_insert(const options& opt) {
+        latencies lat(opt.ops);
+        unsigned long id = jnp1::maptel_create();
+        auto start = bench_clock::now();
+        for (size_t i = 0; i != opt.ops; i++) {
+            string src = number(i), dst = number(i * 7 + 1);
+            auto op_start = bench_clock::now();
+            jnp1::maptel_insert(id, src.c_str(), dst.c_str());
+            lat[i] = elapsed_ns(op_start);
+        }
+        report("insert (C++)", lat, elapsed_ns(start) * 1e-9);
+        jnp1::maptel_delete(id);
+
+        id = jnp1::maptel_create();
+        start = bench_clock::now();
+        maptel_bench_c_insert(id, 0, opt.ops, lat.data());
+        report("insert (C)", lat, elapsed_ns(start) * 1e-9);
+
+        // The dictionary is reused for erases of random numbers, half 
+        // of which are present.
+        mt19937_64 rng(1);
+        start = bench_clock::now();
+        for (size_t i = 0; i != opt.ops; i++) {
+            string src = number(rng() % (2 * opt.ops));
+            auto op_start = bench_clock::now();
+            jnp1::maptel_erase(id, src.c_str());
+            lat[i] = elapsed_ns(op_start);
+        }
+        report("erase", lat, elapsed_ns(start) * 1e-9);
+        jnp1::maptel_delete(id);
+    }
+
+    // Transforms the heads of chains with lengths drawn uniformly from 
+    // 1 to max_chain; cycle_percent of the chains are closed into cycles.
+    void bench_transform(const options& opt) {
+        mt19937_64 rng(2);
+        unsigned long id = jnp1::maptel_create();
+        vector<string> heads;
+        unsigned long next = 0;
+        for (size_t total = 0; total < opt.ops; ) {
+            size_t len = 1 + rng() % opt.max_chain;
+            unsigned long head = next;
+            for (size_t k = 0; k != len; k++, next++)
+                jnp1::maptel_insert(id, number(next).c_str(), 
+                                    number(next + 1).c_str());
+            if (rng() % 100 < opt.cycle_percent)
+                jnp1::maptel_insert(id, number(next).c_str(), 
+                                    number(head).c_str());
+            next++;
+            heads.push_back(number(head));
+            total += len;
+        }
+
+        latencies lat(opt.ops);
+        char dst[jnp1::TEL_NUM_MAX_LEN + 1];
+        auto start = bench_clock::now();
+        for (size_t i = 0; i != opt.ops; i++) {
+            const string& src = heads[rng() % heads.size()];
+            auto op_start = bench_clock::now();
+            jnp1::maptel_transform(id, src.c_str(), dst, sizeof(dst));
+            lat[i] = elapsed_ns(op_start);
+        }
+        report("transform", lat, elapsed_ns(start) * 1e-9);
+
+        jnp1::maptel_statistics stats;
+        jnp1::maptel_stats(id, &stats);
+        printf("%-16s chains:", "");
+        for (size_t k = 0; k != jnp1::MAPTEL_CHAIN_HIST_LEN; k++)
+            printf(" %lu", stats.chain_hist[k]);
+        printf("  cycles: %lu\n", stats.cycles);
+        jnp1::maptel_delete(id);
+    }
+
+    // Creates, fills, queries and deletes short-lived dictionaries from 
+    // many threads. One operation is the whole life of a dictionary.
+    void bench_churn(const options& opt) {
+        size_t per_thread = max<size_t>(opt.ops / opt.dict_size / opt.threads, 1);
+        vector<latencies> lats(opt.threads, latencies(per_thread));
+        vector<thread> workers;
+        auto start = bench_clock::now();
+        for (unsigned t = 0; t != opt.threads; t++) {
+            workers.emplace_back([&opt, &lats, t, per_thread] {
+                char dst[jnp1::TEL_NUM_MAX_LEN + 1];
+                for (size_t i = 0; i != per_thread; i++) {
+                    auto op_start = bench_clock::now();
+                    unsigned long id = jnp1::maptel_create();
+                    for (size_t k = 0; k != opt.dict_size; k++)
+                        jnp1::maptel_insert(id, number(k).c_str(), 
+                                            number(k + 1).c_str());
+                    jnp1::maptel_transform(id, "0", dst, sizeof(dst));
+                    jnp1::maptel_delete(id);
+                    lats[t][i] = elapsed_ns(op_start);
+                }
+            });
+        }
+        for (thread& w : workers)
+            w.join();
+        double secs = elapsed_ns(start) * 1e-9;
+
+        latencies lat;
+        for (const latencies& l : lats)
+            lat.insert(lat.end(), l.begin(), l.end());
+        report("churn", lat, secs);
+    }
+
+    // Clones a dictionary of ops changes and writes CLONE_WRITES random 
+    // changes into the clone. One operation is the clone, the writes and 
+    // the deletion of the clone; it copies only the pages written to.
+    void bench_clone(const options& opt) {
+        const size_t CLONE_WRITES = 64, rounds = 1000;
+        unsigned long id = jnp1::maptel_create();
+        for (size_t i = 0; i != opt.ops; i++)
+            jnp1::maptel_insert(id, number(i).c_str(), number(i + 1).c_str());
+
+        mt19937_64 rng(3);
+        latencies lat(rounds);
+        auto start = bench_clock::now();
+        for (size_t i = 0; i != rounds; i++) {
+            auto op_start = bench_clock::now();
+            unsigned long clone = jnp1::maptel_clone(id);
+            for (size_t k = 0; k != CLONE_WRITES; k++)
+                jnp1::maptel_insert(clone, number(rng() % opt.ops).c_str(), 
+                                    "0");
+            jnp1::maptel_delete(clone);
+            lat[i] = elapsed_ns(op_start);
+        }
+        report("clone + writes", lat, elapsed_ns(start) * 1e-9);
+        jnp1::maptel_delete(id);
+    }
+
+    // Mutations of a single dictionary in the durable mode, including 
+    // the final sync.
+    void bench_durable(const options& opt) {
+        remove((opt.log_path + ".log").c_str());
+        remove((opt.log_path + ".snap").c_str());
+        if (jnp1::maptel_durable_open(opt.log_path.c_str()) != 0) {
+            fprintf(stderr, "cannot open %s\n", opt.log_path.c_str());
+            return;
+        }
+
+        latencies lat(opt.ops);
+        unsigned long id = jnp1::maptel_create();
+        auto start = bench_clock::now();
+        for (size_t i = 0; i != opt.ops; i++) {
+            string src = number(i), dst = number(i * 7 + 1);
+            auto op_start = bench_clock::now();
+            jnp1::maptel_insert(id, src.c_str(), dst.c_str());
+            lat[i] = elapsed_ns(op_start);
+        }
+        jnp1::maptel_durable_sync();
+        report("insert (durable)", lat, elapsed_ns(start) * 1e-9);
+        jnp1::maptel_delete(id);
+        jnp1::maptel_durable_close();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    options opt;
+    int c;
+    while ((c = getopt(argc, argv, "n:c:y:k:t:l:")) != -1) {
+        switch (c) {
+        case 'n': opt.ops = strtoul(optarg, nullptr, 10); break;
+        case 'c': opt.max_chain = strtoul(optarg, nullptr, 10); break;
+        case 'y': opt.cycle_percent = strtoul(optarg, nullptr, 10); break;
+        case 'k': opt.dict_size = strtoul(optarg, nullptr, 10); break;
+        case 't': opt.threads = strtoul(optarg, nullptr, 10); break;
+        case 'l': opt.log_path = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-n ops] [-c max_chain] "
+                    "[-y cycle_percent] [-k dict_size] [-t threads] "
+                    "[-l log_path]\n", argv[0]);
+            return 1;
+        }
+    }
+    opt.ops = max<size_t>(opt.ops, 1);
+    opt.max_chain = max<size_t>(opt.max_chain, 1);
+    opt.dict_size = max<size_t>(opt.dict_size, 1);
+    opt.threads = max(opt.threads, 1U);
+
+    bench_insert(opt);
+    bench_transform(opt);
+    bench_churn(opt);
+    bench_clone(opt);
+    bench_durable(opt);
+    return 0;
+}
@@ -0,0 +1,27 @@
+/* Bulk insert through the C interface of maptel, used by maptel_bench. */
+
+#include <stdio.h>
+#include <time.h>
+#include "../maptel.h"
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Inserts n changes of the numbers seed, seed + 1, ... into the dictionary 
+   with the id and saves the time of every insert in nanoseconds into lat. */
+void maptel_bench_c_insert(unsigned long id, unsigned long seed, 
+                           size_t n, unsigned long long *lat) {
+    char src[TEL_NUM_MAX_LEN + 1], dst[TEL_NUM_MAX_LEN + 1];
+    size_t i;
+    for (i = 0; i != n; i++) {
+        unsigned long long start;
+        sprintf(src, "%lu", seed + i);
+        sprintf(dst, "%lu", (seed + i) * 7 + 1);
+        start = now_ns();
+        maptel_insert(id, src, dst);
+        lat[i] = now_ns() - start;
+    }
+}
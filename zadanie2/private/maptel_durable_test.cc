@@ -0,0 +1,109 @@
+// Tests of the recovery in the durable mode. Restores a dictionary 
+// after a restart, then checks that logs and snapshots cut short, 
+// also within their headers, are rejected without reading past 
+// their ends (checked by the assertions of std::string).
+//
+// g++ -std=c++11 -D_GLIBCXX_ASSERTIONS -fsanitize=address,undefined 
+//     ../maptel.cc maptel_durable_test.cc -o maptel_durable_test -pthread
+// ./maptel_durable_test [path]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include "../cmaptel"
+
+using namespace std;
+
+// Unlike assert, checks also with NDEBUG, as the checked calls have 
+// side effects.
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+namespace {
+    void check(bool ok, const char *cond, int line) {
+        if (!ok) {
+            fprintf(stderr, "maptel_durable_test:%d: %s failed\n", line, cond);
+            exit(1);
+        }
+    }
+
+    string path = "/tmp/maptel_durable_test";
+
+    void remove_files() {
+        unlink((path + ".log").c_str());
+        unlink((path + ".snap").c_str());
+    }
+
+    void write_file(const string& name, const string& data) {
+        FILE *f = fopen(name.c_str(), "wb");
+        CHECK(f);
+        fwrite(data.data(), 1, data.size(), f);
+        fclose(f);
+    }
+
+    string read_file(const string& name) {
+        string data;
+        FILE *f = fopen(name.c_str(), "rb");
+        CHECK(f);
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            data.append(chunk, n);
+        fclose(f);
+        return data;
+    }
+
+    // Creates a dictionary with a single change and returns its id.
+    unsigned long create_dictionary() {
+        CHECK(jnp1::maptel_durable_open(path.c_str()) == 0);
+        unsigned long id = jnp1::maptel_create();
+        jnp1::maptel_insert(id, "123", "456");
+        CHECK(jnp1::maptel_durable_close() == 0);
+        jnp1::maptel_delete(id);
+        return id;
+    }
+
+    void test_restart() {
+        remove_files();
+        unsigned long id = create_dictionary();
+
+        char dst[jnp1::TEL_NUM_MAX_LEN + 1];
+        CHECK(jnp1::maptel_durable_open(path.c_str()) == 0);
+        jnp1::maptel_transform(id, "123", dst, sizeof(dst));
+        CHECK(strcmp(dst, "456") == 0);
+        CHECK(jnp1::maptel_durable_close() == 0);
+        jnp1::maptel_delete(id);
+    }
+
+    // Cuts the file to every length shorter than its first len bytes 
+    // and checks that the durable mode refuses to start.
+    void test_truncated(const string& name, size_t len) {
+        remove_files();
+        unsigned long id = create_dictionary();
+        if (name == path + ".snap") {
+            CHECK(jnp1::maptel_durable_open(path.c_str()) == 0);
+            CHECK(jnp1::maptel_durable_snapshot() == 0);
+            CHECK(jnp1::maptel_durable_close() == 0);
+            jnp1::maptel_delete(id);
+        }
+
+        const string data = read_file(name);
+        CHECK(data.size() >= len);
+        for (size_t n = 1; n < len; n++) {
+            write_file(name, data.substr(0, n));
+            CHECK(jnp1::maptel_durable_open(path.c_str()) == -1);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) path = argv[1];
+
+    test_restart();
+    test_truncated(path + ".log", 16);
+    test_truncated(path + ".snap", 16);
+    remove_files();
+    printf("maptel_durable_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Tests of the maptel daemon and its client library on a single machine. 
+// Starts the daemon on a socket in a temporary directory, runs pipelined 
+// requests through the client and checks the replies, including invalid 
+// and over-long numbers, which have to fail alone without breaking the 
+// connection. Then checks that the durable daemon compacts its log into 
+// a snapshot and restores the dictionaries after a restart.
+//
+// g++ -O2 -std=c++11 -DNDEBUG ../maptel.cc ../maptel_server.cc 
+//     -o maptel_server -pthread
+// g++ -std=c++11 -I.. ../maptel_client.cc maptel_server_test.cc 
+//     -o maptel_server_test
+// ./maptel_server_test ./maptel_server
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "maptel_client.h"
+
+using namespace std;
+
+// Unlike assert, checks also with NDEBUG, as the checked calls have 
+// side effects.
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+namespace {
+    const char SNAPSHOT_BYTES[] = "4096";
+    const size_t BATCH = 20000;
+
+    string server_path, dir, socket_path, durable_path;
+    pid_t server = -1;
+
+    void stop_server();
+
+    void check(bool ok, const char *cond, int line) {
+        if (!ok) {
+            fprintf(stderr, "maptel_server_test:%d: %s failed\n", line, cond);
+            stop_server();
+            exit(1);
+        }
+    }
+
+    // Starts the durable daemon and connects to it, retrying until it 
+    // listens.
+    maptel_client *start_server() {
+        server = fork();
+        if (server == 0) {
+            execl(server_path.c_str(), server_path.c_str(), 
+                  socket_path.c_str(), "2", durable_path.c_str(), 
+                  SNAPSHOT_BYTES, static_cast<char *>(nullptr));
+            _exit(127);
+        }
+        CHECK(server > 0);
+
+        for (int i = 0; i != 500; i++) {
+            maptel_client *client = maptel_client_connect(socket_path.c_str());
+            if (client) return client;
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        CHECK(!"the daemon does not listen");
+        return nullptr;
+    }
+
+    void stop_server() {
+        if (server <= 0) return;
+        kill(server, SIGTERM);
+        int status;
+        waitpid(server, &status, 0);
+        server = -1;
+    }
+
+    string transform(maptel_client *client, unsigned long id, 
+                     const char *src) {
+        char dst[64];
+        CHECK(maptel_client_transform(client, id, src, dst, sizeof(dst)) == 0);
+        return dst;
+    }
+
+    string number(size_t i) {
+        return to_string(100000000 + i);
+    }
+
+    // Pipelines a batch of inserts and erases and checks the dictionary.
+    unsigned long test_requests(maptel_client *client) {
+        unsigned long id;
+        CHECK(maptel_client_create(client, &id) == 0);
+        for (size_t i = 0; i != BATCH; i++)
+            maptel_client_insert(client, id, number(i).c_str(), 
+                                 number(i + 1).c_str());
+        for (size_t i = 0; i < BATCH; i += 2)
+            maptel_client_erase(client, id, number(i).c_str());
+        CHECK(maptel_client_flush(client) == 0);
+
+        CHECK(transform(client, id, number(0).c_str()) == number(0));
+        CHECK(transform(client, id, number(1).c_str()) == number(2));
+        CHECK(transform(client, id, "42") == "42");
+
+        maptel_client_insert(client, id, "1", "2");
+        maptel_client_insert(client, id, "2", "1");
+        CHECK(transform(client, id, "1") == "1");
+        return id;
+    }
+
+    // Sends invalid numbers and requests of a missing dictionary among 
+    // valid requests. Only the former fail, the connection survives.
+    void test_invalid(maptel_client *client, unsigned long id) {
+        const string longer(30, '1'), longest(300, '2');
+        maptel_client_insert(client, id, "12a", "3");
+        maptel_client_insert(client, id, "", "3");
+        maptel_client_insert(client, id, longer.c_str(), "3");
+        maptel_client_insert(client, id, "4", longest.c_str());
+        maptel_client_erase(client, id, longest.c_str());
+        maptel_client_insert(client, id + 1000, "5", "6");
+        maptel_client_insert(client, id, "7", "8");
+        CHECK(maptel_client_flush(client) == 6);
+
+        char dst[64];
+        CHECK(maptel_client_transform(client, id, longest.c_str(), 
+                                      dst, sizeof(dst)) == -1);
+        CHECK(transform(client, id, "7") == "8");
+        CHECK(transform(client, id, "4") == "4");
+    }
+
+    // Waits until the daemon writes a snapshot of the dictionaries.
+    void test_snapshot() {
+        struct stat st;
+        string snap = durable_path + ".snap";
+        for (int i = 0; i != 500 && stat(snap.c_str(), &st) != 0; i++)
+            this_thread::sleep_for(chrono::milliseconds(10));
+        CHECK(stat(snap.c_str(), &st) == 0);
+    }
+
+    void test_restart(unsigned long id) {
+        stop_server();
+        maptel_client *client = start_server();
+        CHECK(transform(client, id, number(1).c_str()) == number(2));
+        CHECK(transform(client, id, "7") == "8");
+
+        maptel_client_delete(client, id);
+        CHECK(maptel_client_flush(client) == 0);
+        maptel_client_delete(client, id);
+        CHECK(maptel_client_flush(client) == 1);
+        maptel_client_close(client);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s server_path\n", argv[0]);
+        return 1;
+    }
+    server_path = argv[1];
+    char tmp[] = "/tmp/maptel_server_test.XXXXXX";
+    CHECK(mkdtemp(tmp));
+    dir = tmp;
+    socket_path = dir + "/socket";
+    durable_path = dir + "/maptel";
+
+    maptel_client *client = start_server();
+    unsigned long id = test_requests(client);
+    test_invalid(client, id);
+    maptel_client_close(client);
+    test_snapshot();
+    test_restart(id);
+    stop_server();
+
+    unlink((durable_path + ".log").c_str());
+    unlink((durable_path + ".snap").c_str());
+    rmdir(dir.c_str());
+    printf("maptel_server_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,518 @@
+// Benchmarks of VeryLongInt. By default reports the time (in ns/op) 
+// of the decimal and hexadecimal conversions in both directions, +, -, 
+// *, /, %, << and >> for operands of 1, 2, 5, 10, ... up to 10^6 
+// digits, followed by the scaling exponents of the operations, the 
+// slopes of log(time) against log(length) between consecutive lengths: 
+// about 1 for linear operations, 2 for quadratic ones. With -c also 
+// writes the results to the given CSV file, for plotting. With -j runs 
+// the operations on the given number of threads (0 for one per 
+// hardware thread).
+//
+// With -t compares, for every operand length (in digits), one level of 
+// Karatsuba against the schoolbook method, one level of Toom-Cook 3-way 
+// against Karatsuba, and the NTT against Toom-Cook, and reports the 
+// lengths from which each algorithm pays off, to be used as the 
+// thresholds in very_long_int.cc. With -v checks the products of the 
+// subquadratic algorithms against the schoolbook ones instead.
+//
+// With -a times a batch computation with many short-lived intermediate 
+// values, allocated from the default heap and from an arena released 
+// after every batch.
+//
+// With -n compares the division of a 2n-digit number by an n-digit one 
+// by Newton's reciprocal iteration against the long division, reports 
+// the length from which Newton's division pays off, and times the 
+// integer square root of the 2n-digit number.
+//
+// With -s compares the single-digit multiplication, division and 
+// addition in place against the general operators.
+//
+// With -p times the modular exponentiation with a full-length exponent 
+// and an odd modulus, by powmod and by binary exponentiation with 
+// a division after every multiplication.
+//
+// With -g compares gcd and modinv, by Lehmer's algorithm, against 
+// Euclid's algorithm written with the division operators.
+//
+// g++ -O2 -std=c++11 -pthread ../very_long_int.cc very_long_int_bench.cc 
+//     -o very_long_int_bench
+// ./very_long_int_bench [-m max_digits] [-j threads] [-c csv_file]
+//     [-t | -v | -a | -n | -s | -p | -g]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "../very_long_int.hh"
+
+using namespace std;
+
+namespace {
+    typedef chrono::steady_clock bench_clock;
+    typedef VeryLongInt::Threshold Threshold;
+
+    const size_t NEVER = numeric_limits<size_t>::max();
+
+    struct options {
+        size_t max_digits = 0;      // 0 for the default of the mode
+        const char *csv = nullptr;
+        unsigned threads = 1;
+        bool tune = false;
+        bool verify = false;
+        bool arena = false;
+        bool newton = false;
+        bool small = false;
+        bool powmod = false;
+        bool gcd = false;
+    };
+
+    struct thresholds {
+        size_t karatsuba, toom3, ntt;
+    };
+
+    mt19937_64 rng(42);
+
+    void set_thresholds(const thresholds& t) {
+        VeryLongInt::setThreshold(Threshold::Karatsuba, t.karatsuba);
+        VeryLongInt::setThreshold(Threshold::Toom3, t.toom3);
+        VeryLongInt::setThreshold(Threshold::Ntt, t.ntt);
+    }
+
+    // Returns a random number of exactly the given number of bits.
+    VeryLongInt random_bits(size_t bits) {
+        VeryLongInt x = 1;
+        for (size_t i = 0; i < bits; i += 32) {
+            x <<= 32;
+            x += rng() >> 32;
+        }
+        return x >> ((bits % 32 ? 32 - bits % 32 : 0) + 1);
+    }
+
+    // Returns a random number of exactly n digits.
+    VeryLongInt random_number(size_t n) {
+        return random_bits(n * VeryLongInt::LOGB);
+    }
+
+    // Returns the mean time (in ns) of the operation.
+    template <typename Operation>
+    double time_op(Operation op) {
+        size_t rounds = 0;
+        auto start = bench_clock::now();
+        chrono::nanoseconds elapsed;
+        do {
+            op();
+            rounds++;
+            elapsed = bench_clock::now() - start;
+        } while (elapsed < chrono::milliseconds(50));
+        return double(elapsed.count()) / rounds;
+    }
+
+    // Returns the slope of log(time) against log(length) of the k-th 
+    // operation between the i-th length, the last one by default, and 
+    // the previous one.
+    double exponent(const vector<size_t>& lengths, 
+                    const vector<vector<double>>& times, size_t k, 
+                    size_t i = 0) {
+        if (!i) i = lengths.size() - 1;
+        return log(times[i][k] / times[i - 1][k]) / 
+               log(double(lengths[i]) / lengths[i - 1]);
+    }
+
+    // Returns the mean time (in ns) of x * y with the given thresholds.
+    double time_mul(const VeryLongInt& x, const VeryLongInt& y, 
+                    const thresholds& t) {
+        set_thresholds(t);
+        return time_op([&] { VeryLongInt z = x * y; });
+    }
+
+    string to_string(const VeryLongInt& x) {
+        ostringstream os;
+        os << x;
+        return os.str();
+    }
+
+    // Returns the longest operand length (in digits) of the mode.
+    size_t max_digits(const options& opt, size_t mode_default) {
+        return opt.max_digits ? opt.max_digits : mode_default;
+    }
+
+    // Returns the length following n in the sequence 1, 2, 5, 10, ...
+    size_t next_length(size_t n) {
+        size_t decade = 1;
+        while (n >= 10 * decade) decade *= 10;
+        if (n == decade) return 2 * decade;
+        if (n == 2 * decade) return 5 * decade;
+        return 10 * decade;
+    }
+
+    const char *const OPS[] = {
+        "from_string", "to_string", "from_hex", "to_hex", 
+        "+", "-", "*", "/", "%", "<<", ">>"
+    };
+    const size_t OPS_COUNT = sizeof(OPS) / sizeof(OPS[0]);
+
+    // Stores the times (in ns) of the basic operations on n-digit 
+    // operands in times, in the order of OPS. The subtraction takes 
+    // x + y - y, the division and modulo divide a 2n-digit number by 
+    // an n-digit one and the shifts move by 37 bits.
+    void time_ops(size_t n, double *times) {
+        const VeryLongInt x = random_number(n), y = random_number(n);
+        const VeryLongInt sum = x + y, xy = x * y + x;
+        const string dec = to_string(x), hex = x.toString(16);
+        VeryLongInt z;
+
+        *times++ = time_op([&] { z = VeryLongInt(dec); });
+        *times++ = time_op([&] { to_string(x); });
+        *times++ = time_op([&] { z = VeryLongInt::fromHex(hex); });
+        *times++ = time_op([&] { x.toString(16); });
+        *times++ = time_op([&] { z = x + y; });
+        *times++ = time_op([&] { z = sum - y; });
+        *times++ = time_op([&] { z = x * y; });
+        *times++ = time_op([&] { z = xy / y; });
+        *times++ = time_op([&] { z = xy % y; });
+        *times++ = time_op([&] { z = x << 37; });
+        *times++ = time_op([&] { z = x >> 37; });
+    }
+
+    // Times the basic operations on operands of growing lengths and 
+    // reports their scaling exponents.
+    bool bench_ops(const options& opt) {
+        FILE *csv = nullptr;
+        if (opt.csv) {
+            csv = fopen(opt.csv, "w");
+            if (!csv) {
+                perror(opt.csv);
+                return false;
+            }
+            fprintf(csv, "op,digits,ns_per_op,exponent\n");
+        }
+
+        vector<size_t> lengths;
+        vector<vector<double>> times;
+        printf("%8s", "digits");
+        for (const char *op : OPS)
+            printf(" %12s", op);
+        printf("\n");
+        for (size_t n = 1; n <= max_digits(opt, 1000000); n = next_length(n)) {
+            lengths.push_back(n);
+            times.emplace_back(OPS_COUNT);
+            time_ops(n, times.back().data());
+
+            printf("%8zu", n);
+            for (double t : times.back())
+                printf(" %12.0f", t);
+            printf("\n");
+            fflush(stdout);
+
+            for (size_t k = 0; csv && k < OPS_COUNT; k++) {
+                fprintf(csv, "%s,%zu,%.1f,", OPS[k], n, times.back()[k]);
+                if (times.size() > 1)
+                    fprintf(csv, "%.3f", exponent(lengths, times, k));
+                fprintf(csv, "\n");
+            }
+        }
+        if (csv) fclose(csv);
+
+        printf("\nscaling exponents\n%8s", "digits");
+        for (const char *op : OPS)
+            printf(" %12s", op);
+        printf("\n");
+        for (size_t i = 1; i < lengths.size(); i++) {
+            printf("%8zu", lengths[i]);
+            for (size_t k = 0; k < OPS_COUNT; k++)
+                printf(" %12.2f", exponent(lengths, times, k, i));
+            printf("\n");
+        }
+        return true;
+    }
+
+    // Updates the length from which the algorithm wins, which has to 
+    // win for all the longer operands too.
+    void update_win(size_t& wins, size_t n, double time, double other) {
+        if (time >= other) wins = 0;
+        else if (!wins) wins = n;
+    }
+
+    // Computes the sum of (x y + x) mod (y + 1) over a batch of pairs.
+    VeryLongInt batch(const vector<VeryLongInt>& xs, 
+                      const vector<VeryLongInt>& ys) {
+        VeryLongInt sum = 0;
+        for (size_t i = 0; i < xs.size(); i++)
+            sum += (xs[i] * ys[i] + xs[i]) % (ys[i] + 1);
+        return sum;
+    }
+
+    // Times batches of operations on operands of 8 to 64 digits, with 
+    // the intermediate values allocated from the heap and from an arena.
+    void bench_arena(const options& opt) {
+        const size_t batch_size = 100;
+        printf("%8s %14s %14s %8s\n", "digits", "heap ns/op", 
+               "arena ns/op", "speedup");
+        for (size_t n = 8; n <= 64 && n <= max_digits(opt, 64); n *= 2) {
+            vector<VeryLongInt> xs, ys;
+            for (size_t i = 0; i < batch_size; i++) {
+                xs.push_back(random_number(n));
+                ys.push_back(random_number(n / 2));
+            }
+
+            VeryLongInt expected = batch(xs, ys), result;
+            double heap = time_op([&] { result = batch(xs, ys); });
+            VeryLongInt::Arena arena;
+            double pooled = time_op([&] {
+                {
+                    VeryLongInt::ResourceScope scope(arena);
+                    // result was created outside the scope, so the copy 
+                    // is allocated from the heap.
+                    result = batch(xs, ys);
+                }
+                arena.release();
+            });
+            if (result != expected)
+                printf("FAIL arena result differs\n");
+            printf("%8zu %14.1f %14.1f %7.2fx\n", n, heap / batch_size, 
+                   pooled / batch_size, heap / pooled);
+        }
+    }
+
+    // Compares the division by Newton's iteration, forced at the top 
+    // level, against the long division.
+    void bench_newton(const options& opt) {
+        const size_t tuned = VeryLongInt::getThreshold(Threshold::Newton);
+        size_t newton_wins = 0;
+        printf("%8s %14s %14s %14s %14s\n", "digits", "long div ns", 
+               "newton ns", "tuned ns", "isqrt ns");
+        for (size_t n = 8; n <= max_digits(opt, 16384); n += n / 4) {
+            VeryLongInt y = random_number(n), x = random_number(n) * y;
+            VeryLongInt q;
+
+            VeryLongInt::setThreshold(Threshold::Newton, NEVER);
+            double knuth = n > 65536 ? 0 : time_op([&] { q = x / y; });
+            VeryLongInt::setThreshold(Threshold::Newton, n);
+            double newton = time_op([&] { q = x / y; });
+            VeryLongInt::setThreshold(Threshold::Newton, tuned);
+            double div = time_op([&] { q = x / y; });
+            double root = time_op([&] { q = isqrt(x); });
+            printf("%8zu %14.0f %14.0f %14.0f %14.0f\n", 
+                   n, knuth, newton, div, root);
+
+            if (knuth) update_win(newton_wins, n, newton, knuth);
+        }
+        printf("Newton wins from %zu digits (threshold %zu)\n", 
+               newton_wins, tuned);
+    }
+
+    // Times the operations with a single-digit operand, by the general 
+    // operators and in place.
+    void bench_small(const options& opt) {
+        const unsigned long long m = 0x9e3779b97f4a7c15ULL;
+        printf("%8s %12s %12s %12s %12s %12s %12s\n", "digits", 
+               "* ns", "mulSmall ns", "/ ns", "divmodSm. ns", 
+               "+ ns", "addSmall ns");
+        for (size_t n = 1; n <= max_digits(opt, 16384); n *= 4) {
+            const VeryLongInt x = random_number(n);
+            VeryLongInt z;
+
+            double mul = time_op([&] { z = x * m; });
+            double mul_small = time_op([&] { z = x; z.mulSmall(m); });
+            double div = time_op([&] { z = x / m; });
+            double div_small = time_op([&] { z = x; z.divmodSmall(m); });
+            double add = time_op([&] { z = x + m; });
+            double add_small = time_op([&] { z = x; z.addSmall(m); });
+            printf("%8zu %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f\n", n, 
+                   mul, mul_small, div, div_small, add, add_small);
+        }
+    }
+
+    // Returns base^exp mod m by binary exponentiation with divisions.
+    VeryLongInt naive_powmod(const VeryLongInt& base, const VeryLongInt& exp, 
+                             const VeryLongInt& m) {
+        VeryLongInt result = 1;
+        for (size_t i = exp.numberOfBinaryDigits(); i-- > 0;) {
+            result = result * result % m;
+            if (((exp >> i) % 2) != 0)
+                result = result * base % m;
+        }
+        return result;
+    }
+
+    // Times the modular exponentiation with n-digit operands.
+    void bench_powmod(const options& opt) {
+        printf("%8s %14s %14s %8s\n", "digits", "naive ns", "powmod ns", 
+               "speedup");
+        for (size_t n = 1; n <= 64 && n <= max_digits(opt, 64); n *= 2) {
+            VeryLongInt m = random_number(n);
+            if (m % 2 == 0) m += 1;
+            VeryLongInt base = random_number(n) % m;
+            VeryLongInt exp = random_number(n), result;
+            VeryLongInt expected = naive_powmod(base, exp, m);
+
+            double naive = time_op([&] { naive_powmod(base, exp, m); });
+            double fast = time_op([&] { result = powmod(base, exp, m); });
+            if (result != expected)
+                printf("FAIL powmod result differs\n");
+            printf("%8zu %14.0f %14.0f %7.2fx\n", n, naive, fast, 
+                   naive / fast);
+        }
+    }
+
+    // Returns gcd(a, b) by Euclid's algorithm.
+    VeryLongInt naive_gcd(VeryLongInt a, VeryLongInt b) {
+        while (b) {
+            VeryLongInt r = a % b;
+            a = std::move(b);
+            b = std::move(r);
+        }
+        return a;
+    }
+
+    // Returns a^-1 mod m by the extended Euclid's algorithm, tracking 
+    // the absolute values of the cofactors of a, which alternate in 
+    // sign, or NaN if there is none.
+    VeryLongInt naive_modinv(VeryLongInt a, VeryLongInt m) {
+        VeryLongInt b = m, u = 1, v = 0, q, r;
+        bool neg = false;
+        while (b) {
+            divmod(a, b, q, r);
+            u += q * v;
+            std::swap(u, v);
+            a = std::move(b);
+            b = std::move(r);
+            neg = !neg;
+        }
+        if (a != 1) return NaN();
+        u %= m;
+        return neg && u ? m - u : u;
+    }
+
+    // Times gcd and modinv of n-digit operands.
+    void bench_gcd(const options& opt) {
+        printf("%8s %14s %14s %8s %14s %14s %8s\n", "digits", "euclid ns", 
+               "gcd ns", "speedup", "euclid inv ns", "modinv ns", 
+               "speedup");
+        for (size_t n = 1; n <= max_digits(opt, 512); n *= 2) {
+            VeryLongInt m = random_number(n), a = random_number(n);
+            if (m % 2 == 0) m += 1;
+            while (gcd(a, m) != 1) a += 1;
+            VeryLongInt g, inv;
+            if (gcd(a * 6, m * 6) != naive_gcd(a * 6, m * 6) || 
+                modinv(a, m) != naive_modinv(a, m))
+                printf("FAIL gcd result differs\n");
+
+            double naive = time_op([&] { g = naive_gcd(a, m); });
+            double fast = time_op([&] { g = gcd(a, m); });
+            double naive_inv = time_op([&] { inv = naive_modinv(a, m); });
+            double fast_inv = time_op([&] { inv = modinv(a, m); });
+            printf("%8zu %14.0f %14.0f %7.2fx %14.0f %14.0f %7.2fx\n", n, 
+                   naive, fast, naive / fast, naive_inv, fast_inv, 
+                   naive_inv / fast_inv);
+        }
+    }
+
+    // Compares the times of the algorithms for every operand length.
+    void bench_thresholds(const options& opt, const thresholds& tuned) {
+        size_t karatsuba_wins = 0, toom3_wins = 0, ntt_wins = 0;
+
+        printf("%8s %14s %14s %14s %14s %14s %14s\n", "digits", 
+               "basecase ns", "karatsuba ns", "karatsuba2 ns", "toom3 ns", 
+               "toom3-2 ns", "ntt ns");
+        for (size_t n = 8; n <= max_digits(opt, 16384); n += n / 4) {
+            VeryLongInt x = random_number(n), y = random_number(n);
+            double base = n > 8192 ? 0 : time_mul(x, y, {NEVER, NEVER, NEVER});
+            double kara = time_mul(x, y, {n, NEVER, NEVER});
+            double kara_tuned = time_mul(x, y, {tuned.karatsuba, NEVER, NEVER});
+            double toom = time_mul(x, y, {tuned.karatsuba, n, NEVER});
+            double toom_tuned = time_mul(x, y, {tuned.karatsuba, tuned.toom3, 
+                                                NEVER});
+            double ntt = time_mul(x, y, {tuned.karatsuba, tuned.toom3, n});
+            printf("%8zu %14.0f %14.0f %14.0f %14.0f %14.0f %14.0f\n", 
+                   n, base, kara, kara_tuned, toom, toom_tuned, ntt);
+
+            if (base) update_win(karatsuba_wins, n, kara, base);
+            update_win(toom3_wins, n, toom, kara_tuned);
+            update_win(ntt_wins, n, ntt, toom_tuned);
+        }
+
+        printf("Karatsuba wins from %zu digits (threshold %zu)\n", 
+               karatsuba_wins, tuned.karatsuba);
+        printf("Toom3 wins from %zu digits (threshold %zu)\n", 
+               toom3_wins, tuned.toom3);
+        printf("NTT wins from %zu digits (threshold %zu)\n", 
+               ntt_wins, tuned.ntt);
+    }
+
+    // Checks the products of random operands, computed with every 
+    // algorithm at the top level, against the schoolbook ones.
+    bool verify(const options& opt) {
+        const thresholds algorithms[] = {
+            {4, NEVER, NEVER}, {4, 4, NEVER}, {4, 4, 4}, {NEVER, NEVER, 4}
+        };
+        size_t failures = 0, cases = 0;
+        for (size_t n = 1; n <= max_digits(opt, 16384); n += n / 2 + 1) {
+            size_t m = 1 + rng() % n;
+            VeryLongInt x = random_number(n), y = random_number(m);
+            VeryLongInt ones = (VeryLongInt(1) << n * VeryLongInt::LOGB) - 1;
+            set_thresholds({NEVER, NEVER, NEVER});
+            VeryLongInt xy = x * y, square = ones * ones;
+
+            for (const thresholds& t : algorithms) {
+                set_thresholds(t);
+                cases += 2;
+                if (x * y != xy || ones * ones != square) {
+                    failures++;
+                    printf("FAIL %zu x %zu digits, thresholds %zu %zu %zu\n", 
+                           n, m, t.karatsuba, t.toom3, t.ntt);
+                }
+            }
+        }
+        printf("%zu cases, %zu failures\n", cases, failures);
+        return failures == 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    options opt;
+    int c;
+    while ((c = getopt(argc, argv, "m:j:c:tvanspg")) != -1) {
+        switch (c) {
+        case 'm': opt.max_digits = strtoul(optarg, nullptr, 10); break;
+        case 'j': opt.threads = strtoul(optarg, nullptr, 10); break;
+        case 'c': opt.csv = optarg; break;
+        case 't': opt.tune = true; break;
+        case 'v': opt.verify = true; break;
+        case 'a': opt.arena = true; break;
+        case 'n': opt.newton = true; break;
+        case 's': opt.small = true; break;
+        case 'p': opt.powmod = true; break;
+        case 'g': opt.gcd = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-m max_digits] [-j threads] "
+                    "[-c csv_file] [-t | -v | -a | -n | -s | -p | -g]\n", 
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    const thresholds tuned = {
+        VeryLongInt::getThreshold(Threshold::Karatsuba),
+        VeryLongInt::getThreshold(Threshold::Toom3),
+        VeryLongInt::getThreshold(Threshold::Ntt)
+    };
+    VeryLongInt::setThreadCount(opt.threads);
+    bool ok = true;
+    if (opt.verify) ok = verify(opt);
+    else if (opt.tune) bench_thresholds(opt, tuned);
+    else if (opt.arena) bench_arena(opt);
+    else if (opt.newton) bench_newton(opt);
+    else if (opt.small) bench_small(opt);
+    else if (opt.powmod) bench_powmod(opt);
+    else if (opt.gcd) bench_gcd(opt);
+    else ok = bench_ops(opt);
+    set_thresholds(tuned);
+    return ok ? 0 : 1;
+}
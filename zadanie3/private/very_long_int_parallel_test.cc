@@ -0,0 +1,129 @@
+// Tests of the parallel decimal conversions. Converts long numbers 
+// from several application threads at once, while the cached powers 
+// of 10 are still being computed, and fails if they do not finish in 
+// time. Then parses and prints long numbers on several threads while 
+// the values of the calling thread are allocated from an arena, and 
+// compares them with the serial conversions. Built with 
+// ThreadSanitizer to catch the forked tasks allocating from the arena 
+// of the caller. The optional argument is the length of the long 
+// number of the first test, 2000000 digits by default; ThreadSanitizer 
+// runs faster with fewer.
+//
+// g++ -O1 -g -std=c++11 -fsanitize=thread ../very_long_int.cc 
+//     very_long_int_parallel_test.cc -o very_long_int_parallel_test -pthread
+// ./very_long_int_parallel_test [digits]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../very_long_int.hh"
+
+using namespace std;
+
+// Unlike assert, checks also with NDEBUG.
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+namespace {
+    typedef VeryLongInt::Threshold Threshold;
+
+    const chrono::seconds TIMEOUT(120);
+
+    void check(bool ok, const char *cond, int line) {
+        if (!ok) {
+            fprintf(stderr, "very_long_int_parallel_test:%d: %s failed\n", 
+                    line, cond);
+            exit(1);
+        }
+    }
+
+    string random_decimal(mt19937_64& gen, size_t n) {
+        string dec(n, '0');
+        for (char& c : dec)
+            c = static_cast<char>('0' + gen() % 10);
+        dec[0] = '1';
+        return dec;
+    }
+
+    string to_string(const VeryLongInt& x) {
+        ostringstream os;
+        os << x;
+        return os.str();
+    }
+
+    void test_arena(const string& dec, const VeryLongInt& expected) {
+        VeryLongInt::Arena arena;
+        VeryLongInt::ResourceScope scope(arena);
+        for (int round = 0; round != 4; round++) {
+            VeryLongInt x(dec);
+            CHECK(x == expected);
+            CHECK(to_string(x) == dec);
+        }
+    }
+
+    // Parses a long number on one application thread and short ones 
+    // in a loop on the others, all sharing the thread pool. Has to run 
+    // first, before the powers of 10 are cached.
+    void test_threads(mt19937_64& gen, size_t n) {
+        const string big = random_decimal(gen, n);
+        vector<string> small;
+        for (int i = 0; i != 3; i++)
+            small.push_back(random_decimal(gen, n / 50));
+
+        atomic<bool> done(false), ok(true);
+        vector<thread> threads;
+        threads.emplace_back([&] {
+            if (to_string(VeryLongInt(big)) != big) ok = false;
+            done = true;
+        });
+        for (const string& dec : small)
+            threads.emplace_back([&] {
+                while (!done)
+                    if (to_string(VeryLongInt(dec)) != dec) ok = false;
+            });
+
+        // A deadlocked thread cannot be joined, give up on it.
+        const chrono::steady_clock::time_point deadline = 
+            chrono::steady_clock::now() + TIMEOUT;
+        while (!done && chrono::steady_clock::now() < deadline)
+            this_thread::sleep_for(chrono::milliseconds(10));
+        if (!done) {
+            fprintf(stderr, "very_long_int_parallel_test: deadlock\n");
+            _Exit(1);
+        }
+        for (thread& t : threads)
+            t.join();
+        CHECK(ok);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    mt19937_64 gen(2024);
+    const size_t parallel = VeryLongInt::getThreshold(Threshold::Parallel);
+    const size_t threads_digits = argc > 1 ? strtoul(argv[1], nullptr, 10) 
+                                           : 2000000;
+
+    VeryLongInt::setThreadCount(2);
+    VeryLongInt::setThreshold(Threshold::Parallel, 4);
+    test_threads(gen, threads_digits);
+    VeryLongInt::setThreshold(Threshold::Parallel, parallel);
+
+    for (size_t n : {1000, 20000, 100000}) {
+        const string dec = random_decimal(gen, n);
+        VeryLongInt::setThreadCount(1);
+        const VeryLongInt expected(dec);
+
+        VeryLongInt::setThreadCount(4);
+        VeryLongInt::setThreshold(Threshold::Parallel, 4);
+        test_arena(dec, expected);
+        VeryLongInt::setThreshold(Threshold::Parallel, parallel);
+    }
+    VeryLongInt::setThreadCount(1);
+    printf("very_long_int_parallel_test: ok\n");
+    return 0;
+}
@@ -1,15 +1,1518 @@
 #include "very_long_int.hh"
 #include <ostream>
-#include <iomanip>
 #include <cmath>
 #include <cctype>
+#include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define VERY_LONG_INT_AVX2
+#include <immintrin.h>
+#endif
 
 
 using std::size_t;
 
-const int VeryLongInt::BASE = 268435456;   // 2^28
-const int VeryLongInt::LOGB = 28;          // log2(BASE);
+const int VeryLongInt::LOGB = 64;          // log2(2^64)
+
+
+namespace {
+
+typedef std::uint64_t limb_t;
+typedef unsigned __int128 dlimb_t;     // Holds a product of two digits
+
+const int LIMB_BITS = 64;
+
+// The largest power of ten fitting in a digit, the radix of the 
+// decimal conversions.
+const limb_t DEC_BASE = 10000000000000000000ULL;    // 10^19
+const size_t DEC_LOGB = 19;                         // log10(DEC_BASE)
+
+// Lengths from which the decimal conversions divide and conquer, 
+// in decimal digits for parsing and in digits for printing.
+const size_t PARSE_THRESHOLD = 40 * DEC_LOGB;
+const size_t PRINT_THRESHOLD = 40;
+
+// Byte order of the machine.
+const bool HOST_BIG_ENDIAN = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+
+// The shortest operands split by the subquadratic algorithms.
+const size_t MIN_THRESHOLD = 4;
+
+// Operand lengths (in digits) from which the subquadratic algorithms 
+// are used and from which their independent parts run in parallel, 
+// see the benchmark in private/very_long_int_bench.cc.
+size_t thresholds[] = {
+    32,     // Karatsuba
+    600,    // Toom3
+    12000,  // Ntt
+    500,    // Newton
+    2000    // Parallel
+};
+
+// Extra bits of the approximations refined by Newton's iterations, 
+// which keep their errors within a few units.
+const size_t NEWTON_GUARD_BITS = 4;
+
+
+#ifdef VERY_LONG_INT_AVX2
+
+// The shortest operands (in digits) passed to the vectorized kernels.
+const size_t AVX2_MIN_DIGITS = 8;
+
+
+// Returns true if the processor supports AVX2.
+bool has_avx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+
+
+// Returns the lanes of the 4-bit mask m as all-ones or zero digits.
+__attribute__((target("avx2")))
+inline __m256i lanes_of(unsigned m)
+{
+    const __m256i bits = _mm256_set_epi64x(8, 4, 2, 1);
+    __m256i v = _mm256_and_si256(_mm256_set1_epi64x(m), bits);
+    return _mm256_cmpeq_epi64(v, bits);
+}
+
+
+// Returns the 4-bit mask of the lanes set in v.
+__attribute__((target("avx2")))
+inline unsigned mask_of(__m256i v)
+{
+    return _mm256_movemask_pd(_mm256_castsi256_pd(v));
+}
+
+
+// Resolves the carries of a block of four digits. The mask g holds 
+// the lanes which overflowed, p the lanes which pass an incoming carry 
+// on, and cr the carry into the block. Returns the mask of the lanes 
+// receiving a carry and stores the carry out of the block in cr.
+inline unsigned block_carries(unsigned g, unsigned p, limb_t& cr)
+{
+    unsigned c = ((g << 1) | static_cast<unsigned>(cr)) + p;
+    cr = c >> 4;
+    return (c ^ p) & 0xF;
+}
+
+
+// Adds the n digits of b to the n digits of a, four at a time, with 
+// the incoming carry cr. Every block computes the lane sums at once 
+// and propagates the carries across the lanes through bit masks.
+// Requires n divisible by 4. Returns the outgoing carry.
+__attribute__((target("avx2")))
+limb_t add_avx2(limb_t *r, const limb_t *a, const limb_t *b, size_t n, 
+                limb_t cr)
+{
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i sum = _mm256_add_epi64(x, y);
+        __m256i g = _mm256_cmpgt_epi64(_mm256_xor_si256(x, sign), 
+                                       _mm256_xor_si256(sum, sign));
+        __m256i p = _mm256_cmpeq_epi64(sum, ones);
+        unsigned c = block_carries(mask_of(g), mask_of(p), cr);
+        sum = _mm256_sub_epi64(sum, lanes_of(c));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i), sum);
+    }
+    return cr;
+}
+
+
+// Subtracts the n digits of b from the n digits of a, four at a time, 
+// with the incoming borrow br, like add_avx2. Returns the outgoing 
+// borrow.
+__attribute__((target("avx2")))
+limb_t sub_avx2(limb_t *r, const limb_t *a, const limb_t *b, size_t n, 
+                limb_t br)
+{
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i diff = _mm256_sub_epi64(x, y);
+        __m256i g = _mm256_cmpgt_epi64(_mm256_xor_si256(y, sign), 
+                                       _mm256_xor_si256(x, sign));
+        __m256i p = _mm256_cmpeq_epi64(diff, zero);
+        unsigned c = block_carries(mask_of(g), mask_of(p), br);
+        diff = _mm256_add_epi64(diff, lanes_of(c));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i), diff);
+    }
+    return br;
+}
+
+
+// Computes the digits r[i] for i in [lo, hi) of the left shift by 
+// 0 < s < LIMB_BITS bits, from the highest block down, so that r may 
+// alias x. Requires lo >= 1 and hi - lo divisible by 4.
+__attribute__((target("avx2")))
+void shift_left_avx2(limb_t *r, const limb_t *x, size_t lo, size_t hi, 
+                     int s)
+{
+    const __m128i ls = _mm_cvtsi32_si128(s);
+    const __m128i rs = _mm_cvtsi32_si128(LIMB_BITS - s);
+    for (size_t i = hi; i > lo; i -= 4) {
+        const limb_t *xi = x + i - 4;
+        __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xi));
+        __m256i low = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(xi - 1));
+        __m256i v = _mm256_or_si256(_mm256_sll_epi64(cur, ls), 
+                                    _mm256_srl_epi64(low, rs));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i - 4), v);
+    }
+}
+
+
+// Computes the digits r[i] for i in [0, n) of the right shift by 
+// 0 < s < LIMB_BITS bits, from the lowest block up, so that r may 
+// alias x. Requires the digit x[n] and n divisible by 4.
+__attribute__((target("avx2")))
+void shift_right_avx2(limb_t *r, const limb_t *x, size_t n, int s)
+{
+    const __m128i rs = _mm_cvtsi32_si128(s);
+    const __m128i ls = _mm_cvtsi32_si128(LIMB_BITS - s);
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i cur = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(x + i));
+        __m256i high = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(x + i + 1));
+        __m256i v = _mm256_or_si256(_mm256_srl_epi64(cur, rs), 
+                                    _mm256_sll_epi64(high, ls));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(r + i), v);
+    }
+}
+
+#endif /* VERY_LONG_INT_AVX2 */
+
+
+// Adds the number b of bn digits to the number a of an >= bn digits, 
+// stores the an digits of the sum in r and returns the carry. 
+// The result may alias a or b. Uses the AVX2 kernel if available.
+limb_t add(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn)
+{
+    limb_t cr = 0;
+    size_t i = 0;
+#ifdef VERY_LONG_INT_AVX2
+    if (bn >= AVX2_MIN_DIGITS && has_avx2()) {
+        i = bn & ~size_t(3);
+        cr = add_avx2(r, a, b, i, cr);
+    }
+#endif
+    for (; i < bn; i++) {
+        dlimb_t t = dlimb_t(a[i]) + b[i] + cr;
+        r[i] = static_cast<limb_t>(t);
+        cr = static_cast<limb_t>(t >> LIMB_BITS);
+    }
+    for (; i < an; i++) {
+        r[i] = a[i] + cr;
+        cr = r[i] < cr;
+    }
+    return cr;
+}
+
+
+// Subtracts the number b of bn digits from the number a of an >= bn 
+// digits, stores the an digits of the difference in r and returns the 
+// borrow. The result may alias a or b. Uses the AVX2 kernel if 
+// available.
+limb_t sub(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn)
+{
+    limb_t br = 0;
+    size_t i = 0;
+#ifdef VERY_LONG_INT_AVX2
+    if (bn >= AVX2_MIN_DIGITS && has_avx2()) {
+        i = bn & ~size_t(3);
+        br = sub_avx2(r, a, b, i, br);
+    }
+#endif
+    for (; i < bn; i++) {
+        dlimb_t t = dlimb_t(a[i]) - b[i] - br;
+        r[i] = static_cast<limb_t>(t);
+        br = static_cast<limb_t>(t >> LIMB_BITS) & 1;
+    }
+    for (; i < an; i++) {
+        limb_t d = a[i];
+        r[i] = d - br;
+        br = d < br;
+    }
+    return br;
+}
+
+
+// Adds the number x of xn digits to the number r of rn >= xn digits 
+// in place. The sum has to fit in rn digits.
+void add_into(limb_t *r, size_t rn, const limb_t *x, size_t xn)
+{
+    limb_t cr = add(r, r, xn, x, xn);
+    for (size_t i = xn; cr && i < rn; i++)
+        cr = ++r[i] == 0;
+}
+
+
+// Multiplies the number x of n digits by the digit m, adds the digit c, 
+// stores the n low digits in r and returns the highest one. 
+// The result may alias x.
+limb_t mul_add_digit(limb_t *r, const limb_t *x, size_t n, limb_t m, limb_t c)
+{
+    for (size_t i = 0; i < n; i++) {
+        dlimb_t t = dlimb_t(x[i]) * m + c;
+        r[i] = static_cast<limb_t>(t);
+        c = static_cast<limb_t>(t >> LIMB_BITS);
+    }
+    return c;
+}
+
+
+// Returns the number of digits of the number x of n digits without 
+// the leading zeros.
+size_t length(const limb_t *x, size_t n)
+{
+    while (n && !x[n - 1]) n--;
+    return n;
+}
+
+
+class TaskGroup;
+
+// A task forked by a group.
+struct Task
+{
+    std::function<void()> fn;
+    TaskGroup *group;
+};
+
+
+// Fixed set of worker threads with a queue of tasks each. A thread 
+// pushes the tasks it forks to the back of its own queue and takes 
+// them back from there, while idle threads steal the oldest, and 
+// so the largest, tasks from the fronts of the other queues. Threads 
+// from outside the pool share one more queue.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator =(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    void push(Task*);
+    bool runOne();
+
+private:
+    struct Queue
+    {
+        std::mutex mtx;
+        std::deque<Task*> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued;             // Tasks in all the queues
+    std::mutex sleep_mtx;
+    std::condition_variable wake;
+    bool stop;
+
+    size_t self() const;
+    Task* pop(size_t);
+    void work(size_t);
+};
+
+
+// Tasks forked by one thread and joined by wait(), which runs the 
+// pending tasks of the pool in the meantime. Without a pool the tasks 
+// run at once, in the calling thread.
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool *pool) : pool(pool), pending(0) {}
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator =(const TaskGroup&) = delete;
+    ~TaskGroup();
+
+    void run(std::function<void()>);
+    void wait();
+    void finish(Task*);
+
+private:
+    ThreadPool *pool;
+    std::atomic<size_t> pending;            // Forked and unfinished tasks
+    std::mutex error_mtx;
+    std::exception_ptr error;               // The first exception thrown
+};
+
+
+// The pool of the parallel mode, null in the serial one.
+std::unique_ptr<ThreadPool> thread_pool;
+unsigned thread_count = 1;
+std::mutex thread_pool_mtx;
+
+// The pool index of the worker thread, or nullptr outside pools.
+thread_local const ThreadPool *worker_pool = nullptr;
+thread_local size_t worker_index = 0;
+
+
+// Starts the given number of worker threads.
+ThreadPool::ThreadPool(unsigned n) : queued(0), stop(false)
+{
+    for (unsigned i = 0; i <= n; i++)
+        queues.emplace_back(new Queue);
+    for (unsigned i = 0; i < n; i++)
+        threads.emplace_back(&ThreadPool::work, this, i);
+}
+
+
+// Stops and joins the worker threads. All the groups have to be 
+// joined before.
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mtx);
+        stop = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : threads)
+        t.join();
+}
+
+
+// Returns the queue of the calling thread, the shared one for the 
+// threads from outside the pool.
+size_t ThreadPool::self() const
+{
+    return worker_pool == this ? worker_index : threads.size();
+}
+
+
+// Queues the task and wakes up a sleeping worker.
+void ThreadPool::push(Task *t)
+{
+    Queue& q = *queues[self()];
+    {
+        std::lock_guard<std::mutex> lock(q.mtx);
+        q.tasks.push_back(t);
+    }
+    queued++;
+    {
+        std::lock_guard<std::mutex> lock(sleep_mtx);
+    }
+    wake.notify_one();
+}
+
+
+// Takes the newest task of the given queue, or steals the oldest one 
+// of another queue. Returns nullptr if all the queues are empty.
+Task* ThreadPool::pop(size_t i)
+{
+    if (!queued.load())
+        return nullptr;
+    for (size_t k = 0; k < queues.size(); k++) {
+        Queue& q = *queues[(i + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (q.tasks.empty())
+            continue;
+        Task *t;
+        if (k == 0) {
+            t = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        else {
+            t = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        queued--;
+        return t;
+    }
+    return nullptr;
+}
+
+
+// Runs a pending task, if there is any. Returns false otherwise.
+bool ThreadPool::runOne()
+{
+    Task *t = pop(self());
+    if (!t)
+        return false;
+    t->group->finish(t);
+    return true;
+}
+
+
+// The loop of the i-th worker thread, which sleeps while there is 
+// nothing to do.
+void ThreadPool::work(size_t i)
+{
+    worker_pool = this;
+    worker_index = i;
+    for (;;) {
+        if (runOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        wake.wait(lock, [this] { return stop || queued.load() > 0; });
+        if (stop)
+            return;
+    }
+}
+
+
+// Waits for the tasks, ignoring their exceptions.
+TaskGroup::~TaskGroup()
+{
+    while (pending.load())
+        if (!pool->runOne())
+            std::this_thread::yield();
+}
+
+
+// Forks the function, or calls it if there is no pool.
+void TaskGroup::run(std::function<void()> fn)
+{
+    if (!pool) {
+        fn();
+        return;
+    }
+    pending++;
+    pool->push(new Task{std::move(fn), this});
+}
+
+
+// Runs the forked task and destroys it. The task allocates its 
+// values from the default resource, as the resource of the thread 
+// which runs it need not outlive them.
+void TaskGroup::finish(Task *t)
+{
+    {
+        std::unique_ptr<Task> task(t);
+        VeryLongInt::ResourceScope scope(VeryLongInt::defaultResource());
+        try {
+            task->fn();
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(error_mtx);
+            if (!error) error = std::current_exception();
+        }
+    }
+    pending--;
+}
+
+
+// Joins the forked tasks and rethrows the first of their exceptions.
+void TaskGroup::wait()
+{
+    while (pending.load())
+        if (!pool->runOne())
+            std::this_thread::yield();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+
+// Returns the pool if the operands of n digits are long enough to be 
+// processed in parallel, nullptr otherwise.
+ThreadPool* parallel(size_t n)
+{
+    return n >= thresholds[4] ? thread_pool.get() : nullptr;
+}
+
+
+void mul(limb_t*, const limb_t*, size_t, const limb_t*, size_t);
+
+
+// Adds the product of the number x of n digits and the digit m to the 
+// number r of n digits in place and returns the carry digit.
+limb_t addmul_digit(limb_t *r, const limb_t *x, size_t n, limb_t m)
+{
+    limb_t cr = 0;
+    for (size_t i = 0; i < n; i++) {
+        dlimb_t t = dlimb_t(x[i]) * m + r[i] + cr;
+        r[i] = static_cast<limb_t>(t);
+        cr = static_cast<limb_t>(t >> LIMB_BITS);
+    }
+    return cr;
+}
+
+
+// Schoolbook multiplication, one row of a digit by b at a time.
+void mul_basecase(limb_t *r, const limb_t *a, size_t an, 
+                  const limb_t *b, size_t bn)
+{
+    std::fill(r, r + bn, 0);
+    for (size_t i = 0; i < an; i++)
+        r[i + bn] = addmul_digit(r + i, b, bn, a[i]);
+}
+
+
+// Multiplies a by a much shorter b, one bn-digit slice of a at a time.
+void mul_unbalanced(limb_t *r, const limb_t *a, size_t an, 
+                    const limb_t *b, size_t bn)
+{
+    std::vector<limb_t> t(2 * bn);
+    std::fill(r, r + an + bn, 0);
+    for (size_t i = 0; i < an; i += bn) {
+        size_t n = std::min(bn, an - i);
+        mul(t.data(), b, bn, a + i, n);
+        add_into(r + i, an + bn - i, t.data(), n + bn);
+    }
+}
+
+
+// Karatsuba multiplication: with a = a1 X + a0 and b = b1 X + b0, 
+// a b = a1 b1 X^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) X + a0 b0.
+// The three products are independent and run in parallel for long 
+// operands. Requires an >= bn > ceil(an / 2).
+void mul_karatsuba(limb_t *r, const limb_t *a, size_t an, 
+                   const limb_t *b, size_t bn)
+{
+    const size_t h = (an + 1) / 2;
+    const size_t a1n = an - h, b1n = bn - h;
+    std::vector<limb_t> sa(h + 1), sb(h + 1), z1(2 * h + 2);
+
+    sa[h] = add(sa.data(), a, h, a + h, a1n);
+    sb[h] = add(sb.data(), b, h, b + h, b1n);
+    {
+        TaskGroup group(parallel(bn));
+        group.run([=] { mul(r, a, h, b, h); });
+        group.run([=] { mul(r + 2 * h, a + h, a1n, b + h, b1n); });
+        mul(z1.data(), sa.data(), h + 1, sb.data(), h + 1);
+        group.wait();
+    }
+
+    sub(z1.data(), z1.data(), z1.size(), r, 2 * h);
+    sub(z1.data(), z1.data(), z1.size(), r + 2 * h, a1n + b1n);
+    add_into(r + h, an + bn - h, z1.data(), length(z1.data(), z1.size()));
+}
+
+
+// Divides u1 2^LIMB_BITS + u0 by the normalized digit d > u1, given 
+// v = floor((2^(2 LIMB_BITS) - 1) / d) - 2^LIMB_BITS, by multiplying 
+// with the reciprocal (Moller and Granlund, "Improved division by 
+// invariant integers"). Stores the remainder in r and returns the 
+// quotient.
+inline limb_t div_2by1(limb_t u1, limb_t u0, limb_t d, limb_t v, limb_t& r)
+{
+    const dlimb_t t = dlimb_t(v) * u1 + ((dlimb_t(u1 + 1) << LIMB_BITS) | u0);
+    limb_t q = static_cast<limb_t>(t >> LIMB_BITS);
+    r = u0 - q * d;
+    if (r > static_cast<limb_t>(t)) {
+        q--;
+        r += d;
+    }
+    if (r >= d) {
+        q++;
+        r -= d;
+    }
+    return q;
+}
+
+
+// Divides the number u of un digits by the single digit d, stores the 
+// un digits of the quotient in q and returns the remainder. 
+// The quotient may alias u. The divisor is normalized, and the digits 
+// of u shifted on the fly, so that a single division computes its 
+// reciprocal and every digit of the quotient takes two multiplications.
+limb_t div_digit(limb_t *q, const limb_t *u, size_t un, limb_t d)
+{
+    const int s = __builtin_clzll(d);
+    d <<= s;
+    const limb_t v = static_cast<limb_t>(~dlimb_t(0) / d);
+
+    limb_t rem = s && un ? u[un - 1] >> (LIMB_BITS - s) : 0;
+    for (size_t i = un; i-- > 0;) {
+        limb_t cur = u[i] << s;
+        if (s && i) cur |= u[i - 1] >> (LIMB_BITS - s);
+        q[i] = div_2by1(rem, cur, d, v, rem);
+    }
+    return rem >> s;
+}
+
+
+// Signed number in the sign-magnitude form, used by the interpolation 
+// of the Toom-Cook multiplication. The magnitude has no leading zeros.
+struct signed_limbs
+{
+    std::vector<limb_t> mag;
+    bool neg;
+
+    signed_limbs(const limb_t *x = nullptr, size_t n = 0) : 
+        mag(x, x + length(x, n)), neg(false) {}
+};
+
+
+// Compares the magnitudes of x and y.
+int compare(const signed_limbs& x, const signed_limbs& y)
+{
+    if (x.mag.size() != y.mag.size())
+        return x.mag.size() < y.mag.size() ? -1 : 1;
+    for (size_t i = x.mag.size(); i-- > 0;)
+        if (x.mag[i] != y.mag[i])
+            return x.mag[i] < y.mag[i] ? -1 : 1;
+    return 0;
+}
+
+
+// Returns x + y, or x - y if negate is set.
+signed_limbs add(const signed_limbs& x, const signed_limbs& y, 
+                 bool negate = false)
+{
+    signed_limbs z;
+    bool y_neg = y.neg != negate;
+    if (x.neg == y_neg) {
+        const signed_limbs& u = x.mag.size() >= y.mag.size() ? x : y;
+        const signed_limbs& v = x.mag.size() >= y.mag.size() ? y : x;
+        z.mag.resize(u.mag.size() + 1);
+        z.mag.back() = add(z.mag.data(), u.mag.data(), u.mag.size(), 
+                           v.mag.data(), v.mag.size());
+        z.neg = x.neg;
+    }
+    else {
+        bool swap = compare(x, y) < 0;
+        const signed_limbs& u = swap ? y : x;
+        const signed_limbs& v = swap ? x : y;
+        z.mag.resize(u.mag.size());
+        sub(z.mag.data(), u.mag.data(), u.mag.size(), 
+            v.mag.data(), v.mag.size());
+        z.neg = swap ? y_neg : x.neg;
+    }
+    z.mag.resize(length(z.mag.data(), z.mag.size()));
+    if (z.mag.empty()) z.neg = false;
+    return z;
+}
+
+
+signed_limbs mul(const signed_limbs& x, const signed_limbs& y)
+{
+    signed_limbs z;
+    if (x.mag.empty() || y.mag.empty())
+        return z;
+    z.mag.resize(x.mag.size() + y.mag.size());
+    mul(z.mag.data(), x.mag.data(), x.mag.size(), 
+        y.mag.data(), y.mag.size());
+    z.mag.resize(length(z.mag.data(), z.mag.size()));
+    z.neg = x.neg != y.neg;
+    return z;
+}
+
+
+// Multiplies x by 2.
+void twice(signed_limbs& x)
+{
+    x.mag.push_back(0);
+    x.mag.back() = add(x.mag.data(), x.mag.data(), x.mag.size() - 1, 
+                       x.mag.data(), x.mag.size() - 1);
+    x.mag.resize(length(x.mag.data(), x.mag.size()));
+}
+
+
+// Divides x by the small divisor d, which is known to divide it.
+void divide_exact(signed_limbs& x, limb_t d)
+{
+    div_digit(x.mag.data(), x.mag.data(), x.mag.size(), d);
+    x.mag.resize(length(x.mag.data(), x.mag.size()));
+}
+
+
+// Toom-Cook 3-way multiplication. The operands are split into three 
+// k-digit parts, evaluated at 0, 1, -1, -2 and infinity, multiplied 
+// pointwise, in parallel for long operands, and interpolated with 
+// the sequence of Bodrato. Requires an >= bn > 2 ceil(an / 3).
+void mul_toom3(limb_t *r, const limb_t *a, size_t an, 
+               const limb_t *b, size_t bn)
+{
+    const size_t k = (an + 2) / 3;
+    const signed_limbs a0(a, k), a1(a + k, k), a2(a + 2 * k, an - 2 * k);
+    const signed_limbs b0(b, k), b1(b + k, k), b2(b + 2 * k, bn - 2 * k);
+
+    signed_limbs p = add(a0, a2), q = add(b0, b2);
+    signed_limbs p1 = add(p, a1), q1 = add(q, b1);
+    signed_limbs pm1 = add(p, a1, true), qm1 = add(q, b1, true);
+    signed_limbs pm2 = add(pm1, a2), qm2 = add(qm1, b2);
+    twice(pm2);
+    twice(qm2);
+    pm2 = add(pm2, a0, true);
+    qm2 = add(qm2, b0, true);
+
+    signed_limbs r0, rinf, r1, rm1, r3;
+    {
+        TaskGroup group(parallel(bn));
+        group.run([&] { r0 = mul(a0, b0); });
+        group.run([&] { rinf = mul(a2, b2); });
+        group.run([&] { r1 = mul(p1, q1); });
+        group.run([&] { rm1 = mul(pm1, qm1); });
+        r3 = mul(pm2, qm2);
+        group.wait();
+    }
+
+    r3 = add(r3, r1, true);
+    divide_exact(r3, 3);
+    r1 = add(r1, rm1, true);
+    divide_exact(r1, 2);
+    signed_limbs r2 = add(rm1, r0, true);
+    r3 = add(r2, r3, true);
+    divide_exact(r3, 2);
+    signed_limbs rinf2 = rinf;
+    twice(rinf2);
+    r3 = add(r3, rinf2);
+    r2 = add(r2, r1);
+    r2 = add(r2, rinf, true);
+    r1 = add(r1, r3, true);
+
+    const signed_limbs *coeffs[] = { &r0, &r1, &r2, &r3, &rinf };
+    std::fill(r, r + an + bn, 0);
+    for (size_t i = 0; i < 5; i++) {
+        const std::vector<limb_t>& c = coeffs[i]->mag;
+        add_into(r + i * k, an + bn - i * k, c.data(), c.size());
+    }
+}
+
+
+// Computes b^e modulo P.
+template <std::uint32_t P>
+std::uint32_t pow_mod(std::uint64_t b, std::uint64_t e)
+{
+    std::uint64_t r = 1;
+    for (b %= P; e; e >>= 1, b = b * b % P)
+        if (e & 1) r = r * b % P;
+    return static_cast<std::uint32_t>(r);
+}
+
+
+// Number-theoretic transform of a modulo the prime P with the primitive 
+// root G. The forward transform (decimation in frequency) leaves the 
+// values in the bit-reversed order, which the inverse transform 
+// (decimation in time) expects, so no permutation is needed.
+template <std::uint32_t P, std::uint32_t G>
+void transform(std::vector<std::uint32_t>& a, bool inverse)
+{
+    typedef std::uint64_t wide_t;
+    const size_t n = a.size();
+    std::uint32_t root = pow_mod<P>(G, (P - 1) / n);
+    if (inverse) root = pow_mod<P>(root, P - 2);
+
+    std::vector<std::uint32_t> w(std::max<size_t>(n / 2, 1), 1);
+    for (size_t i = 1; i < n / 2; i++)
+        w[i] = static_cast<std::uint32_t>(wide_t(w[i - 1]) * root % P);
+
+    if (!inverse) {
+        for (size_t h = n / 2, s = 1; h > 0; h /= 2, s *= 2) {
+            for (size_t i = 0; i < n; i += 2 * h) {
+                for (size_t j = 0; j < h; j++) {
+                    std::uint32_t u = a[i + j], v = a[i + j + h];
+                    a[i + j] = u + v >= P ? u + v - P : u + v;
+                    a[i + j + h] = static_cast<std::uint32_t>(
+                        wide_t(u + P - v) * w[j * s] % P);
+                }
+            }
+        }
+        return;
+    }
+
+    for (size_t h = 1, s = n / 2; h < n; h *= 2, s /= 2) {
+        for (size_t i = 0; i < n; i += 2 * h) {
+            for (size_t j = 0; j < h; j++) {
+                std::uint32_t u = a[i + j];
+                std::uint32_t v = static_cast<std::uint32_t>(
+                    wide_t(a[i + j + h]) * w[j * s] % P);
+                a[i + j] = u + v >= P ? u + v - P : u + v;
+                a[i + j + h] = u >= v ? u - v : u + P - v;
+            }
+        }
+    }
+    const wide_t n_inv = pow_mod<P>(n, P - 2);
+    for (std::uint32_t& x : a)
+        x = static_cast<std::uint32_t>(x * n_inv % P);
+}
+
+
+// Computes the cyclic convolution modulo P of the numbers a and b, 
+// split into n 32-bit pieces, where n is a power of two. The forward 
+// transforms run in parallel if the pool is given.
+template <std::uint32_t P, std::uint32_t G>
+std::vector<std::uint32_t> convolve(const limb_t *a, size_t an, 
+                                    const limb_t *b, size_t bn, size_t n, 
+                                    ThreadPool *pool)
+{
+    std::vector<std::uint32_t> fa(n, 0), fb(n, 0);
+    for (size_t i = 0; i < an; i++) {
+        fa[2 * i] = static_cast<std::uint32_t>(a[i]) % P;
+        fa[2 * i + 1] = static_cast<std::uint32_t>(a[i] >> 32) % P;
+    }
+    for (size_t i = 0; i < bn; i++) {
+        fb[2 * i] = static_cast<std::uint32_t>(b[i]) % P;
+        fb[2 * i + 1] = static_cast<std::uint32_t>(b[i] >> 32) % P;
+    }
+    {
+        TaskGroup group(pool);
+        group.run([&fb] { transform<P, G>(fb, false); });
+        transform<P, G>(fa, false);
+        group.wait();
+    }
+    for (size_t i = 0; i < n; i++)
+        fa[i] = static_cast<std::uint32_t>(std::uint64_t(fa[i]) * fb[i] % P);
+    transform<P, G>(fa, true);
+    return fa;
+}
+
+
+// Primes of the form c 2^k + 1 with their primitive roots. Their product 
+// exceeds 2^86 and bounds every column of a product of NTT_MAX_LENGTH 
+// pieces, whose columns are below 2^22 2^64.
+const std::uint32_t NTT_P1 = 998244353, NTT_G1 = 3;    // 119 2^23 + 1
+const std::uint32_t NTT_P2 = 167772161, NTT_G2 = 3;    // 5 2^25 + 1
+const std::uint32_t NTT_P3 = 469762049, NTT_G3 = 3;    // 7 2^26 + 1
+
+// The longest product (in 32-bit pieces) computed with the NTT, bounded 
+// by the largest power of two dividing all of P - 1.
+const size_t NTT_MAX_LENGTH = size_t(1) << 23;
+
+
+// NTT multiplication. The digits are split into 32-bit pieces, the 
+// product is convolved modulo three primes and every column is restored 
+// with the Chinese remainder theorem (Garner's algorithm). For long 
+// operands the three convolutions, and the two forward transforms of 
+// each, run in parallel. Requires 2 (an + bn) <= NTT_MAX_LENGTH.
+void mul_ntt(limb_t *r, const limb_t *a, size_t an, 
+             const limb_t *b, size_t bn)
+{
+    typedef std::uint64_t wide_t;
+
+    const size_t pieces = 2 * (an + bn);
+    size_t n = 1;
+    while (n < pieces - 1) n *= 2;
+    ThreadPool *pool = parallel(bn);
+    std::vector<std::uint32_t> c1, c2, c3;
+    {
+        TaskGroup group(pool);
+        group.run([&] {
+            c1 = convolve<NTT_P1, NTT_G1>(a, an, b, bn, n, pool);
+        });
+        group.run([&] {
+            c2 = convolve<NTT_P2, NTT_G2>(a, an, b, bn, n, pool);
+        });
+        c3 = convolve<NTT_P3, NTT_G3>(a, an, b, bn, n, pool);
+        group.wait();
+    }
+
+    const wide_t p1_inv = pow_mod<NTT_P2>(NTT_P1, NTT_P2 - 2);
+    const wide_t p1_mod = NTT_P1 % NTT_P3;
+    const wide_t p12_inv = pow_mod<NTT_P3>(p1_mod * NTT_P2, NTT_P3 - 2);
+    const dlimb_t p12 = wide_t(NTT_P1) * NTT_P2;
+
+    dlimb_t cr = 0;
+    for (size_t i = 0; i < pieces; i++) {
+        if (i < pieces - 1) {
+            wide_t v1 = c1[i];
+            wide_t v2 = (c2[i] + NTT_P2 - v1 % NTT_P2) * p1_inv % NTT_P2;
+            wide_t v3 = (c3[i] + 2 * wide_t(NTT_P3) - v1 % NTT_P3 
+                         - v2 * p1_mod % NTT_P3) % NTT_P3 * p12_inv % NTT_P3;
+            cr += v1 + v2 * NTT_P1 + v3 * p12;
+        }
+        limb_t piece = static_cast<std::uint32_t>(cr);
+        if (i % 2) r[i / 2] |= piece << 32;
+        else r[i / 2] = piece;
+        cr >>= 32;
+    }
+}
+
+
+// Multiplies a of an digits by b of bn digits and stores the an + bn 
+// digits of the product in r, which must not overlap the operands. 
+// Chooses the algorithm by the length of the operands.
+void mul(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn)
+{
+    if (an < bn) {
+        std::swap(a, b);
+        std::swap(an, bn);
+    }
+    if (bn < thresholds[0])
+        mul_basecase(r, a, an, b, bn);
+    else if (bn >= thresholds[2] && 2 * (an + bn) <= NTT_MAX_LENGTH)
+        mul_ntt(r, a, an, b, bn);
+    else if (2 * bn <= an + 1)
+        mul_unbalanced(r, a, an, b, bn);
+    else if (bn < thresholds[1] || bn <= 2 * ((an + 2) / 3))
+        mul_karatsuba(r, a, an, b, bn);
+    else
+        mul_toom3(r, a, an, b, bn);
+}
+
+// Shifts the number x of n >= 1 digits by 0 < s < LIMB_BITS bits to 
+// the left, stores the n low digits in r and returns the digit shifted 
+// out. The result may alias x. Uses the AVX2 kernel if available.
+limb_t shift_left(limb_t *r, const limb_t *x, size_t n, int s)
+{
+    const limb_t cr = x[n - 1] >> (LIMB_BITS - s);
+    size_t i = n - 1;
+#ifdef VERY_LONG_INT_AVX2
+    if (n >= AVX2_MIN_DIGITS && has_avx2()) {
+        size_t lo = 1 + (n - 1) % 4;
+        shift_left_avx2(r, x, lo, n, s);
+        i = lo - 1;
+    }
+#endif
+    for (; i > 0; i--)
+        r[i] = (x[i] << s) | (x[i - 1] >> (LIMB_BITS - s));
+    r[0] = x[0] << s;
+    return cr;
+}
+
+
+// Shifts the number x of n >= 1 digits by 0 < s < LIMB_BITS bits to 
+// the right and stores the n digits in r. The result may alias x. 
+// Uses the AVX2 kernel if available.
+void shift_right(limb_t *r, const limb_t *x, size_t n, int s)
+{
+    size_t i = 0;
+#ifdef VERY_LONG_INT_AVX2
+    if (n >= AVX2_MIN_DIGITS && has_avx2()) {
+        i = (n - 1) & ~size_t(3);
+        shift_right_avx2(r, x, i, s);
+    }
+#endif
+    for (; i + 1 < n; i++)
+        r[i] = (x[i] >> s) | (x[i + 1] << (LIMB_BITS - s));
+    r[n - 1] = x[n - 1] >> s;
+}
+
+
+// Long division (Knuth, TAOCP vol. 2, 4.3.1, Algorithm D). Divides the 
+// number u of un + 1 digits by the number v of vn >= 2 digits, stores 
+// the un - vn + 1 digits of the quotient in q and leaves the remainder 
+// in the vn low digits of u. The divisor has to be normalized, with 
+// the highest bit of its leading digit set, and u[un] < v[vn - 1].
+void div_knuth(limb_t *q, limb_t *u, size_t un, const limb_t *v, size_t vn)
+{
+    const limb_t v1 = v[vn - 1], v2 = v[vn - 2];
+    for (size_t j = un - vn + 1; j-- > 0;) {
+        limb_t *uj = u + j;
+        dlimb_t num = (dlimb_t(uj[vn]) << LIMB_BITS) | uj[vn - 1];
+        dlimb_t qhat = num / v1, rhat = num % v1;
+        while (qhat >> LIMB_BITS || 
+               qhat * v2 > ((rhat << LIMB_BITS) | uj[vn - 2])) {
+            qhat--;
+            rhat += v1;
+            if (rhat >> LIMB_BITS) break;
+        }
+
+        const limb_t qd = static_cast<limb_t>(qhat);
+        limb_t cr = 0, br = 0;
+        for (size_t i = 0; i < vn; i++) {
+            dlimb_t p = dlimb_t(qd) * v[i] + cr;
+            cr = static_cast<limb_t>(p >> LIMB_BITS);
+            dlimb_t t = dlimb_t(uj[i]) - static_cast<limb_t>(p) - br;
+            uj[i] = static_cast<limb_t>(t);
+            br = static_cast<limb_t>(t >> LIMB_BITS) & 1;
+        }
+        dlimb_t t = dlimb_t(uj[vn]) - cr - br;
+        uj[vn] = static_cast<limb_t>(t);
+        br = static_cast<limb_t>(t >> LIMB_BITS) & 1;
+
+        // The estimate was one too large, add the divisor back.
+        q[j] = qd;
+        if (br) {
+            q[j]--;
+            uj[vn] += add(uj, uj, vn, v, vn);
+        }
+    }
+}
+
+
+// Compares the numbers a and b of n digits.
+int compare(const limb_t *a, const limb_t *b, size_t n)
+{
+    for (size_t i = n; i-- > 0;)
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+
+// Montgomery reduction (REDC). Divides the number t of 2n + 1 digits, 
+// below m R with R = 2^(LIMB_BITS n), by R modulo m, destroying t, 
+// and stores the n digits of the result in r. inv is -m^-1 modulo 
+// 2^LIMB_BITS.
+void redc(limb_t *r, limb_t *t, const limb_t *m, size_t n, limb_t inv)
+{
+    for (size_t i = 0; i < n; i++) {
+        limb_t cr = addmul_digit(t + i, m, n, t[i] * inv);
+        add_into(t + i + n, n + 1 - i, &cr, 1);
+    }
+    if (t[2 * n] || compare(t + n, m, n) >= 0)
+        sub(r, t + n, n, m, n);
+    else
+        std::copy(t + n, t + 2 * n, r);
+}
+
+
+// Stores x a - y b in r, for the numbers a and b of n digits, when 
+// the difference is nonnegative. The result may alias a or b.
+void mul_sub_pair(limb_t *r, const limb_t *a, limb_t x, 
+                  const limb_t *b, limb_t y, size_t n)
+{
+    limb_t cx = 0, cy = 0, br = 0;
+    for (size_t i = 0; i < n; i++) {
+        dlimb_t px = dlimb_t(a[i]) * x + cx;
+        dlimb_t py = dlimb_t(b[i]) * y + cy;
+        cx = static_cast<limb_t>(px >> LIMB_BITS);
+        cy = static_cast<limb_t>(py >> LIMB_BITS);
+        dlimb_t t = dlimb_t(static_cast<limb_t>(px)) - 
+                    static_cast<limb_t>(py) - br;
+        r[i] = static_cast<limb_t>(t);
+        br = static_cast<limb_t>(t >> LIMB_BITS) & 1;
+    }
+}
+
+
+// Stores the n low digits of x a + y b in r, for the numbers a and b 
+// of n digits, and returns the rest, below 2^(LIMB_BITS + 1). 
+// The result may alias a or b.
+dlimb_t mul_add_pair(limb_t *r, const limb_t *a, limb_t x, 
+                     const limb_t *b, limb_t y, size_t n)
+{
+    limb_t cx = 0, cy = 0, cr = 0;
+    for (size_t i = 0; i < n; i++) {
+        dlimb_t px = dlimb_t(a[i]) * x + cx;
+        dlimb_t py = dlimb_t(b[i]) * y + cy;
+        cx = static_cast<limb_t>(px >> LIMB_BITS);
+        cy = static_cast<limb_t>(py >> LIMB_BITS);
+        dlimb_t t = dlimb_t(static_cast<limb_t>(px)) + 
+                    static_cast<limb_t>(py) + cr;
+        r[i] = static_cast<limb_t>(t);
+        cr = static_cast<limb_t>(t >> LIMB_BITS);
+    }
+    return dlimb_t(cx) + cy + cr;
+}
+
+
+// Returns the 2 LIMB_BITS bits of the number x of n digits starting 
+// from the bit h.
+dlimb_t leading_bits(const limb_t *x, size_t n, size_t h)
+{
+    const size_t d = h / LIMB_BITS;
+    const int s = h % LIMB_BITS;
+    limb_t w[3];
+    for (size_t i = 0; i < 3; i++)
+        w[i] = d + i < n ? x[d + i] : 0;
+
+    dlimb_t r = ((dlimb_t(w[1]) << LIMB_BITS) | w[0]) >> s;
+    if (s)
+        r |= dlimb_t(w[2]) << (2 * LIMB_BITS - s);
+    return r;
+}
+
+
+// Runs Euclid's algorithm on the leading bits a >= b of the numbers 
+// A >= B, cut at the same position, as long as its quotients are 
+// those of A and B (Jebelean's condition, always if the bits are 
+// exact) and its cofactors fit in a digit. Stores in m the cofactors 
+// {u0, v0, u1, v1} of the last pair of remainders: u0 A - v0 B and 
+// v1 B - u1 A after an even number of steps, both negated after an 
+// odd one. Returns the number of steps.
+size_t lehmer_step(dlimb_t a, dlimb_t b, bool exact, limb_t m[4])
+{
+    dlimb_t u0 = 1, v0 = 0, u1 = 0, v1 = 1;
+    size_t k = 0;
+    while (b) {
+        const dlimb_t q = a - b < b ? 1 : a / b;
+        const dlimb_t r = a - q * b;
+        const dlimb_t u2 = u0 + q * u1, v2 = v0 + q * v1;
+        if (v2 >> LIMB_BITS)
+            break;
+        if (!exact && (r < v2 || b - r < v1 + v2))
+            break;
+
+        a = b;
+        b = r;
+        u0 = u1;
+        v0 = v1;
+        u1 = u2;
+        v1 = v2;
+        k++;
+    }
+
+    m[0] = static_cast<limb_t>(u0);
+    m[1] = static_cast<limb_t>(v0);
+    m[2] = static_cast<limb_t>(u1);
+    m[3] = static_cast<limb_t>(v1);
+    return k;
+}
+
+
+// Returns the size of the window of the sliding-window exponentiation 
+// for an exponent of the given number of bits (HAC, table 14.16).
+int window_size(size_t bits)
+{
+    return bits > 671 ? 6 : bits > 239 ? 5 : bits > 79 ? 4 : 
+           bits > 23 ? 3 : bits > 7 ? 2 : 1;
+}
+
+
+// Returns true if the given order is big-endian, resolving 
+// the native one.
+bool is_big(VeryLongInt::Endian e)
+{
+    return e == VeryLongInt::Endian::Big || 
+           (e == VeryLongInt::Endian::Native && HOST_BIG_ENDIAN);
+}
+
+
+// Returns k if the given base is 2^k, for 1 <= k <= 5, or 0 otherwise.
+int radix_bits(unsigned base)
+{
+    for (int k = 1; k <= 5; k++)
+        if (base == 1u << k)
+            return k;
+    return 0;
+}
+
+
+// Returns the value of the given digit character, in bases up to 32, 
+// or -1 if it is not a digit in any of them.
+int radix_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'v') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'V') return c - 'A' + 10;
+    return -1;
+}
+
+
+// Returns 10^(DEC_LOGB 2^k). The powers are computed once, by repeated 
+// squaring, and shared by the decimal conversions of all threads, so 
+// they are always allocated from the default resource. The squaring 
+// runs unlocked: a parallel one may pick up a task of another thread 
+// which needs the powers too. The cached powers never change and 
+// std::deque keeps them in place, so they can be read meanwhile; 
+// a square computed by two threads at once is appended only once.
+const VeryLongInt& dec_power(size_t k)
+{
+    static std::mutex mtx;
+    static std::deque<VeryLongInt> powers;
+
+    VeryLongInt::ResourceScope scope(VeryLongInt::defaultResource());
+    std::unique_lock<std::mutex> lock(mtx);
+    if (powers.empty())
+        powers.push_back(VeryLongInt(DEC_BASE));
+    while (powers.size() <= k) {
+        const VeryLongInt& last = powers.back();
+        const size_t count = powers.size();
+        lock.unlock();
+        VeryLongInt square = last * last;
+        lock.lock();
+        if (powers.size() == count)
+            powers.push_back(std::move(square));
+    }
+    return powers[k];
+}
+
+
+// Returns an approximation of 2^(2k) / d, for d of exactly k bits, 
+// off by a few units. The reciprocal of the high half of d, computed 
+// recursively, is refined with one Newton's iteration, 
+// x' = 2 x - d x^2 / 2^(2k), which doubles its precision.
+VeryLongInt reciprocal(const VeryLongInt& d, size_t k)
+{
+    if ((k + LIMB_BITS - 1) / LIMB_BITS < thresholds[3])
+        return (VeryLongInt(1) << 2 * k) / d;
+
+    const size_t h = k / 2 + NEWTON_GUARD_BITS;
+    const VeryLongInt y = reciprocal(d >> (k - h), h);
+    return (y << (k - h + 1)) - (d * (y * y) >> 2 * h);
+}
+
+
+// Corrects the approximate quotient q of n / d, given p = q d, and 
+// stores the remainder in r.
+void correct_quotient(const VeryLongInt& n, const VeryLongInt& d, 
+                      VeryLongInt& q, VeryLongInt& p, VeryLongInt& r)
+{
+    while (p > n) {
+        q -= 1;
+        p -= d;
+    }
+    r = n - p;
+    while (r >= d) {
+        q.addSmall(1);
+        r -= d;
+    }
+}
+
+
+// Division by Newton's reciprocal iteration, in a constant number of 
+// multiplications of the length of the operands. Short quotients are 
+// computed from the high parts of the operands; otherwise both are 
+// shifted, so that the divisor has k >= the number of bits of the 
+// quotient, and the quotient is the high half of the product of n and 
+// the reciprocal of d. Requires n >= d > 0.
+void div_newton(const VeryLongInt& n, const VeryLongInt& d, 
+                VeryLongInt& q, VeryLongInt& r)
+{
+    const size_t nb = n.numberOfBinaryDigits();
+    const size_t db = d.numberOfBinaryDigits();
+    const size_t qb = nb - db + 1;
+
+    if (qb + NEWTON_GUARD_BITS < db) {
+        const size_t s = db - qb - NEWTON_GUARD_BITS;
+        VeryLongInt rs;
+        divmod(n >> s, d >> s, q, rs);
+        VeryLongInt p = q * d;
+        correct_quotient(n, d, q, p, r);
+        return;
+    }
+
+    const size_t k = std::max(db, qb), t = k - db;
+    const VeryLongInt dt = d << t, nt = n << t;
+    const VeryLongInt x = reciprocal(dt, k);
+    q = (nt >> (k - 1)) * x >> (k + 1);
+    VeryLongInt p = q * dt;
+    correct_quotient(nt, dt, q, p, r);
+    r >>= t;
+}
+
+} /* Anonymous namespace */
+
+
+namespace {
+
+// Memory resource of the global operator new and delete.
+class HeapResource : public VeryLongInt::MemoryResource
+{
+public:
+    void* allocate(size_t n) override {
+        return ::operator new(n);
+    }
+
+    void deallocate(void *p, size_t) override {
+        ::operator delete(p);
+    }
+};
+
+HeapResource heap_resource;
+thread_local VeryLongInt::MemoryResource *current_resource = nullptr;
+
+} /* Anonymous namespace */
+
+
+// Returns the resource of the global operator new and delete.
+VeryLongInt::MemoryResource& VeryLongInt::defaultResource()
+{
+    return heap_resource;
+}
+
+
+// Returns the resource from which the digits of the values created 
+// in this thread are allocated.
+VeryLongInt::MemoryResource& VeryLongInt::currentResource()
+{
+    return current_resource ? *current_resource : heap_resource;
+}
+
+
+// Creates an arena which allocates blocks of at least the given size.
+VeryLongInt::Arena::Arena(size_t block_size) : 
+    blockSize(block_size), cur(nullptr), end(nullptr) {}
+
+
+VeryLongInt::Arena::~Arena()
+{
+    for (void *block : blocks)
+        ::operator delete(block);
+}
+
+
+// Allocates n bytes from the last block, or from a new one, twice as 
+// large as the previous, if they do not fit.
+void* VeryLongInt::Arena::allocate(size_t n)
+{
+    const size_t align = alignof(std::max_align_t);
+    n = (n + align - 1) & ~(align - 1);
+    if (static_cast<size_t>(end - cur) < n) {
+        size_t size = std::max(n, blockSize);
+        blocks.push_back(::operator new(size));
+        cur = static_cast<char*>(blocks.back());
+        end = cur + size;
+        blockSize *= 2;
+    }
+    void *p = cur;
+    cur += n;
+    return p;
+}
+
+
+// Reclaims the memory only if it was the last allocation, which is 
+// common for temporaries; the rest waits for release().
+void VeryLongInt::Arena::deallocate(void *p, size_t n)
+{
+    const size_t align = alignof(std::max_align_t);
+    n = (n + align - 1) & ~(align - 1);
+    if (static_cast<char*>(p) + n == cur)
+        cur = static_cast<char*>(p);
+}
+
+
+// Frees all the memory allocated from the arena. The largest block is 
+// kept for the allocations that follow, so an arena reused for similar 
+// computations settles on a single block.
+void VeryLongInt::Arena::release()
+{
+    if (blocks.empty())
+        return;
+
+    for (size_t i = 0; i + 1 < blocks.size(); i++)
+        ::operator delete(blocks[i]);
+    blocks.erase(blocks.begin(), blocks.end() - 1);
+    cur = static_cast<char*>(blocks.back());
+}
+
+
+VeryLongInt::ResourceScope::ResourceScope(MemoryResource& res) : 
+    previous(current_resource)
+{
+    current_resource = &res;
+}
+
+
+VeryLongInt::ResourceScope::~ResourceScope()
+{
+    current_resource = previous;
+}
+
+
+// Creates an empty vector (NaN) in the inline storage.
+VeryLongInt::DigitVector::DigitVector() : 
+    ptr(buf), len(0), cap(INLINE_DIGITS), res(&currentResource()) {}
+
+
+// Creates a vector of n copies of the digit d.
+VeryLongInt::DigitVector::DigitVector(size_t n, digit_t d) : 
+    DigitVector()
+{
+    assign(n, d);
+}
+
+
+VeryLongInt::DigitVector::DigitVector(const DigitVector& that) : 
+    DigitVector()
+{
+    assign(that.begin(), that.end());
+}
+
+
+// Takes over the storage of that, together with its memory resource, 
+// or copies its inline digits. Leaves that empty.
+VeryLongInt::DigitVector::DigitVector(DigitVector&& that) : 
+    DigitVector()
+{
+    res = that.res;
+    *this = std::move(that);
+}
+
+
+VeryLongInt::DigitVector::~DigitVector()
+{
+    if (!isInline())
+        res->deallocate(ptr, cap * sizeof(digit_t));
+}
+
+
+VeryLongInt::DigitVector& 
+VeryLongInt::DigitVector::operator =(const DigitVector& that)
+{
+    if (this != &that)
+        assign(that.begin(), that.end());
+    return *this;
+}
+
+
+// Takes over the storage of that if both use the same memory resource, 
+// copies the digits otherwise. Leaves that empty.
+VeryLongInt::DigitVector& 
+VeryLongInt::DigitVector::operator =(DigitVector&& that)
+{
+    if (this == &that)
+        return *this;
+
+    if (that.isInline() || that.res != res) {
+        assign(that.begin(), that.end());
+    }
+    else {
+        if (!isInline())
+            res->deallocate(ptr, cap * sizeof(digit_t));
+        ptr = that.ptr;
+        cap = that.cap;
+        len = that.len;
+        that.ptr = that.buf;
+        that.cap = INLINE_DIGITS;
+    }
+    that.len = 0;
+    return *this;
+}
+
+
+// Grows the storage to hold at least n digits.
+void VeryLongInt::DigitVector::reserve(size_t n)
+{
+    if (n <= cap)
+        return;
+
+    digit_t *p = static_cast<digit_t*>(res->allocate(n * sizeof(digit_t)));
+    std::copy(ptr, ptr + len, p);
+    if (!isInline())
+        res->deallocate(ptr, cap * sizeof(digit_t));
+    ptr = p;
+    cap = n;
+}
+
+
+// Resizes the vector to n digits, the new ones set to d.
+void VeryLongInt::DigitVector::resize(size_t n, digit_t d)
+{
+    if (n > cap)
+        reserve(std::max(n, 2 * cap));
+    if (n > len)
+        std::fill(ptr + len, ptr + n, d);
+    len = n;
+}
+
+
+// Replaces the contents with n copies of the digit d.
+void VeryLongInt::DigitVector::assign(size_t n, digit_t d)
+{
+    len = 0;
+    resize(n, d);
+}
+
+
+// Replaces the contents with the digits [first, last), which must not 
+// be a part of this vector.
+void VeryLongInt::DigitVector::assign(const digit_t *first, 
+                                      const digit_t *last)
+{
+    len = 0;
+    reserve(last - first);
+    std::copy(first, last, ptr);
+    len = last - first;
+}
+
+
+// Removes the digits [first, last).
+void VeryLongInt::DigitVector::erase(digit_t *first, digit_t *last)
+{
+    std::copy(last, end(), first);
+    len -= last - first;
+}
 
 
 // Default constructor
@@ -51,9 +1554,16 @@ VeryLongInt::VeryLongInt(unsigned int x) :
 VeryLongInt::VeryLongInt(unsigned long x) : 
     VeryLongInt(static_cast<unsigned long long>(x)) {}
 
-VeryLongInt::VeryLongInt(unsigned long long x) {
-    do digits.push_back(static_cast<digit_t>(x % BASE));
-    while (x /= BASE);
+VeryLongInt::VeryLongInt(unsigned long long x) : 
+    digits(1, x) {}
+
+
+// Creates a VeryLongInt object with the value of the n digits 
+// at x, least significant first.
+VeryLongInt::VeryLongInt(const digit_t *x, size_t n)
+{
+    digits.assign(x, x + n);
+    trim();
 }
 
 
@@ -68,15 +1578,7 @@ VeryLongInt::VeryLongInt(const std::string& str)
         if (!std::isdigit(c))
             return;
 
-    digits.push_back(0);
-    auto sit = str.begin();
-    while (sit != str.end()) {
-        for (digit_t& digit : digits)
-            digit *= 10;
-        digits.front() += *sit - '0';
-        align();
-        sit++;
-    }
+    *this = fromDecimal(str.data(), str.size());
 }
 
 
@@ -86,50 +1588,270 @@ VeryLongInt::VeryLongInt(const char* str) :
     VeryLongInt(str ? std::string(str) : std::string()) {}
 
 
-// Moves an overflow occurred after some arithmetic 
-// operations to the more significant digits.
-void VeryLongInt::align()
+// Returns the value of the number supplied as a std::string in 
+// the given base, 10 or a power of 2 up to 32, optionally prefixed 
+// with 0x in base 16 and 0b in base 2. Returns NaN if the base or 
+// any of the digits is invalid.
+VeryLongInt VeryLongInt::fromString(const std::string& str, unsigned base)
+{
+    if (base == 10)
+        return VeryLongInt(str);
+
+    const int bits = radix_bits(base);
+    size_t start = 0;
+    if (str.size() > 2 && str[0] == '0' && 
+        ((bits == 4 && (str[1] == 'x' || str[1] == 'X')) || 
+         (bits == 1 && (str[1] == 'b' || str[1] == 'B'))))
+        start = 2;
+
+    if (!bits || start == str.size())
+        return NaN();
+    return fromRadix(str.data() + start, str.size() - start, bits);
+}
+
+
+// Returns the value of the hexadecimal number supplied as 
+// a std::string, optionally prefixed with 0x.
+VeryLongInt VeryLongInt::fromHex(const std::string& str)
+{
+    return fromString(str, 16);
+}
+
+
+// Returns the representation of *this in the given base, 10 or 
+// a power of 2 up to 32, with lowercase letters. Returns "NaN" for 
+// NaN and an empty string for an invalid base.
+std::string VeryLongInt::toString(unsigned base) const
+{
+    if (!isValid())
+        return "NaN";
+
+    std::string str;
+    if (base == 10)
+        toDecimal(str, 0);
+    else if (const int bits = radix_bits(base))
+        toRadix(str, bits, false);
+    return str;
+}
+
+
+// Returns the value of the decimal number of n digits. Long numbers 
+// are split in two, at a cached power of 10, and their halves are 
+// converted recursively, in parallel if long enough, short ones 
+// DEC_LOGB digits at a time.
+VeryLongInt VeryLongInt::fromDecimal(const char *str, size_t n)
 {
-    digit_t cr = 0;
-    auto it = digits.begin();
-    while (it != digits.end()) {
-        *it += cr;
-        cr = *it >> LOGB;
-        *it &= ~- BASE;
-        it++;
+    if (n > PARSE_THRESHOLD) {
+        size_t k = 0, m = DEC_LOGB;
+        while (2 * m < n) {
+            k++;
+            m *= 2;
+        }
+        const VeryLongInt& power = dec_power(k);
+        VeryLongInt x;
+        // A forked task allocates from the default resource, so it 
+        // keeps its half for the caller instead of assigning to a value 
+        // of the caller's resource, which is not safe from two threads.
+        std::unique_ptr<VeryLongInt> low;
+        {
+            TaskGroup group(parallel(power.digits.size()));
+            group.run([&] { 
+                low.reset(new VeryLongInt(fromDecimal(str + n - m, m))); 
+            });
+            x = fromDecimal(str, n - m);
+            group.wait();
+        }
+        x *= power;
+        x += *low;
+        return x;
     }
-    if (cr) digits.push_back(cr);
+
+    VeryLongInt x;
+    size_t first = n % DEC_LOGB ? n % DEC_LOGB : DEC_LOGB;
+    for (size_t i = 0; i < n; i += first, first = DEC_LOGB) {
+        digit_t chunk = 0, power = 1;
+        for (size_t j = i; j < i + first; j++) {
+            chunk = chunk * 10 + (str[j] - '0');
+            power *= 10;
+        }
+        digit_t cr = mul_add_digit(x.digits.data(), x.digits.data(), 
+                                   x.digits.size(), power, chunk);
+        if (cr) x.digits.push_back(cr);
+    }
+    return x;
+}
+
+
+// Appends the decimal representation of *this to out, padded with 
+// leading zeros to width digits. Long numbers are split in two by 
+// a cached power of 10 and their halves are converted recursively, 
+// in parallel if long enough, short ones by repeated division by 
+// DEC_BASE.
+void VeryLongInt::toDecimal(std::string& out, size_t width) const
+{
+    if (digits.size() > PRINT_THRESHOLD) {
+        size_t k = 0, m = DEC_LOGB;
+        while (2 * dec_power(k + 1).digits.size() <= digits.size()) {
+            k++;
+            m *= 2;
+        }
+        VeryLongInt q, r;
+        divmod(*this, dec_power(k), q, r);
+        std::string low;
+        {
+            TaskGroup group(parallel(r.digits.size()));
+            group.run([&] { r.toDecimal(low, m); });
+            q.toDecimal(out, width > m ? width - m : 0);
+            group.wait();
+        }
+        out += low;
+        return;
+    }
+
+    DigitVector bin_digits = digits;
+    std::string dec;
+    size_t n = length(bin_digits.data(), bin_digits.size());
+    do {
+        digit_t chunk = div_digit(bin_digits.data(), bin_digits.data(), 
+                                  n, DEC_BASE);
+        n = length(bin_digits.data(), n);
+        for (size_t i = 0; i < DEC_LOGB && (n || chunk); i++) {
+            dec.push_back('0' + chunk % 10);
+            chunk /= 10;
+        }
+    } while (n);
+
+    if (dec.empty()) dec.push_back('0');
+    if (width > dec.size()) out.append(width - dec.size(), '0');
+    out.append(dec.rbegin(), dec.rend());
+}
+
+
+// Returns the value of the number of n digits in base 2^bits, or NaN 
+// if any of them is invalid. Every digit is or-ed into place at its 
+// bit offset, so the conversion takes linear time.
+VeryLongInt VeryLongInt::fromRadix(const char *str, size_t n, int bits)
+{
+    VeryLongInt x;
+    x.digits.assign((n * bits + LOGB - 1) / LOGB, 0);
+    for (size_t i = 0; i < n; i++) {
+        const int v = radix_digit(str[n - 1 - i]);
+        if (v < 0 || v >> bits)
+            return NaN();
+        const size_t pos = i * bits, d = pos / LOGB;
+        const int s = pos % LOGB;
+        x.digits[d] |= digit_t(v) << s;
+        if (s + bits > LOGB)
+            x.digits[d + 1] |= digit_t(v) >> (LOGB - s);
+    }
+    x.trim();
+    return x;
+}
+
+
+// Appends the representation of *this in base 2^bits to out, 
+// without leading zeros, taking every digit straight from its 
+// bit offset.
+void VeryLongInt::toRadix(std::string& out, int bits, bool upper) const
+{
+    const char *chars = upper ? "0123456789ABCDEFGHIJKLMNOPQRSTUV" 
+                              : "0123456789abcdefghijklmnopqrstuv";
+    const size_t n = (numberOfBinaryDigits() + bits - 1) / bits;
+    const size_t start = out.size();
+    const digit_t mask = (digit_t(1) << bits) - 1;
+    out.resize(start + n);
+    for (size_t i = 0; i < n; i++) {
+        const size_t pos = i * bits, d = pos / LOGB;
+        const int s = pos % LOGB;
+        digit_t v = digits[d] >> s;
+        if (s + bits > LOGB && d + 1 < digits.size())
+            v |= digits[d + 1] << (LOGB - s);
+        out[start + n - 1 - i] = chars[v & mask];
+    }
+}
+
+
+// Removes the leading zero digits.
+void VeryLongInt::trim()
+{
+    while (digits.size() > 1 && !digits.back())
+        digits.pop_back();
+}
+
+
+// Moves the specified amount of digits to the left. 
+// Zeros are shifted in from the right.
+void VeryLongInt::lshift(size_t n)
+{
+    if (!*this) return;
+    digits.resize(digits.size() + n);
+    for (size_t i = digits.size(); i-- > n;)
+        digits[i] = digits[i - n];
+    for (size_t i = n; i-- > 0;)
+        digits[i] = 0;
+}
+
+
+// Moves the specified amount of digits to the right. 
+// Excess digits shifted off to the right are discarded.
+void VeryLongInt::rshift(size_t n) 
+{
+    if (!*this) return;
+    n = std::min(n, digits.size());
+    digits.erase(digits.begin(), digits.begin() + n);
+    if (digits.empty()) digits.push_back(0);
+}
+
+
+// Returns the operand length (in digits) from which the given 
+// algorithm is used.
+size_t VeryLongInt::getThreshold(Threshold t)
+{
+    return thresholds[static_cast<int>(t)];
+}
+
+
+// Sets the operand length (in digits) from which the given 
+// algorithm is used. Shorter operands than MIN_THRESHOLD digits 
+// are not split, as their parts would not be any shorter.
+void VeryLongInt::setThreshold(Threshold t, size_t n)
+{
+    thresholds[static_cast<int>(t)] = std::max(n, MIN_THRESHOLD);
 }
 
 
-// Moves the specified amount of BASE digits to the left. 
-// Zeros are shifted in from the right.
-void VeryLongInt::lshift(size_t n)
+// Returns the number of threads of the parallel mode, 1 in the 
+// serial one.
+unsigned VeryLongInt::getThreadCount()
 {
-    if (!*this) return;
-    digits.resize(digits.size() + n);
-    for (size_t i = digits.size(); i-- > n;)
-        digits[i] = digits[i - n];
-    for (size_t i = n; i-- > 0;)
-        digits[i] = 0;
+    std::lock_guard<std::mutex> lock(thread_pool_mtx);
+    return thread_count;
 }
 
 
-// Moves the specified amount of BASE digits to the right. 
-// Excess digits shifted off to the right are discarded.
-void VeryLongInt::rshift(size_t n) 
+// Sets the number of threads, including the calling one, among which 
+// the long multiplications and decimal conversions are split; 
+// 0 means one per hardware thread and 1 the serial mode. Must not be 
+// called while any thread uses VeryLongInt.
+void VeryLongInt::setThreadCount(unsigned n)
 {
-    if (!*this) return;
-    n = std::min(n, digits.size());
-    digits.erase(digits.begin(), digits.begin() + n);
-    if (digits.empty()) digits.push_back(0);
+    if (n == 0)
+        n = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::lock_guard<std::mutex> lock(thread_pool_mtx);
+    if (n == thread_count)
+        return;
+    thread_pool.reset();
+    if (n > 1)
+        thread_pool.reset(new ThreadPool(n - 1));
+    thread_count = n;
 }
 
 
 // Copy assignment operator [=]
 // Copies the resources held by the right operand into the 
 // left operand.
-VeryLongInt& VeryLongInt::operator =(const VeryLongInt& that) 
+VeryLongInt& VeryLongInt::operator =(const VeryLongInt& that) &
 {
     digits = that.digits;
     return *this;
@@ -139,13 +1861,12 @@ VeryLongInt& VeryLongInt::operator =(const VeryLongInt& that)
 // Move assignment operator [=]
 // Moves the resources held by the right operand to the 
 // left operand and leave the right operand in NaN state.
-VeryLongInt& VeryLongInt::operator =(VeryLongInt&& that) 
+VeryLongInt& VeryLongInt::operator =(VeryLongInt&& that) &
 {
     if (this == &that) 
         return *this;
 
     digits = std::move(that.digits);
-    that.digits.clear();
     return *this;
 }
 
@@ -154,7 +1875,7 @@ VeryLongInt& VeryLongInt::operator =(VeryLongInt&& that)
 // Adds the value of the right operand to value of *this and 
 // assigns the result to it. Produces NaN if any of the 
 // operands is NaN.
-VeryLongInt& VeryLongInt::operator +=(const VeryLongInt& that) 
+VeryLongInt& VeryLongInt::operator +=(const VeryLongInt& that) &
 {
     if (!isValid())
         return *this;
@@ -165,9 +1886,9 @@ VeryLongInt& VeryLongInt::operator +=(const VeryLongInt& that)
     size_t n = std::max(digits.size(), that.digits.size());
     digits.resize(n, 0);
 
-    for (size_t i = 0; i < that.digits.size(); i++)
-        digits[i] += that.digits[i];
-    align();
+    digit_t cr = add(digits.data(), digits.data(), n, 
+                     that.digits.data(), that.digits.size());
+    if (cr) digits.push_back(cr);
     return *this;
 }
 
@@ -176,7 +1897,7 @@ VeryLongInt& VeryLongInt::operator +=(const VeryLongInt& that)
 // Subtracts the value of the right operand from value of 
 // *this and assigns the result to it. Produces NaN if the 
 // difference is negative or any of the operands is NaN.
-VeryLongInt& VeryLongInt::operator -=(const VeryLongInt& that) 
+VeryLongInt& VeryLongInt::operator -=(const VeryLongInt& that) &
 {
     if (!isValid())
         return *this;
@@ -187,17 +1908,9 @@ VeryLongInt& VeryLongInt::operator -=(const VeryLongInt& that)
     if (*this < that)
         return *this = NaN();
 
-    for (size_t i = 0; i < that.digits.size(); i++)
-        digits[i] -= that.digits[i];
-
-    for (size_t i = 0; i < digits.size() - 1; i++) {
-        if (digits[i] < 0) {
-            digits[i] += BASE;
-            digits[i + 1]--;
-        }
-    }
-    while (digits.size() > 1 && !digits.back())
-        digits.pop_back();
+    sub(digits.data(), digits.data(), digits.size(), 
+        that.digits.data(), that.digits.size());
+    trim();
     return *this;
 }
 
@@ -206,7 +1919,7 @@ VeryLongInt& VeryLongInt::operator -=(const VeryLongInt& that)
 // Multiplies the value of *this by the value of the right 
 // operand and assigns the result to *this. Produces NaN 
 // if any of the operands is NaN.
-VeryLongInt& VeryLongInt::operator *=(const VeryLongInt& that) 
+VeryLongInt& VeryLongInt::operator *=(const VeryLongInt& that) &
 {
     if (!isValid())
         return *this;
@@ -215,74 +1928,121 @@ VeryLongInt& VeryLongInt::operator *=(const VeryLongInt& that)
         return *this = NaN();
 
     VeryLongInt product;
-    size_t n = digits.size() + that.digits.size() - 1;
-    product.digits.resize(n, 0);
-
-    for (size_t i = 0; i < digits.size(); i++) {
-        for (size_t j = 0; j < that.digits.size(); j++)
-            product.digits[i + j] += digits[i] * that.digits[j];
-        product.align();
-    }
+    product.digits.resize(digits.size() + that.digits.size());
+    mul(product.digits.data(), digits.data(), digits.size(), 
+        that.digits.data(), that.digits.size());
+    product.trim();
     *this = std::move(product);
     return *this;
 }
 
 
-// Division assignment operator [/=]
-// Divides the value of *this by the value of the right 
-// operand and assigns the result to *this. Produces NaN 
-// if the divisor is zero or any of the operands is NaN.
-VeryLongInt& VeryLongInt::operator /=(const VeryLongInt& that) 
+// Fused multiply-add
+// Adds the product of x and y to the value of *this in place. 
+// Short products are accumulated directly into the digits of 
+// *this, without a temporary for the product. Produces NaN 
+// if any of the operands is NaN.
+VeryLongInt& VeryLongInt::addProduct(const VeryLongInt& x, 
+                                     const VeryLongInt& y) &
 {
     if (!isValid())
         return *this;
 
-    if (!that.isValid() || that == 0)
+    if (!x.isValid() || !y.isValid())
         return *this = NaN();
 
-    VeryLongInt quotient, x, y;
-    size_t n = 1;
-    if (digits.size() > that.digits.size())
-        n = digits.size() - that.digits.size() + 1;
-    quotient.digits.resize(n, 0);
-
-    for (size_t i = n; i-- > 0;) {
-        digit_t l = 0, r = ~-BASE;
-        while (l < r) {
-            digit_t m = (l + r + 1) >> 1;
-            y = that * m;
-            y.lshift(i);
-            if (*this < x + y) r = m - 1;
-            else l = m;
-        }
-        y = that * l;
-        y.lshift(i);
-        x += y;
-        quotient.digits[i] = l;
-    }
-    while (quotient.digits.size() > 1 && !quotient.digits.back())
-        quotient.digits.pop_back();
-    *this = std::move(quotient);
+    const VeryLongInt& a = x.digits.size() >= y.digits.size() ? x : y;
+    const VeryLongInt& b = x.digits.size() >= y.digits.size() ? y : x;
+    const size_t an = a.digits.size(), bn = b.digits.size();
+    if (bn >= thresholds[0] || &a == this || &b == this)
+        return *this += a * b;
+
+    digits.resize(std::max(digits.size(), an + bn) + 1, 0);
+    const size_t n = digits.size();
+    for (size_t i = 0; i < bn; i++) {
+        digit_t cr = addmul_digit(digits.data() + i, a.digits.data(), 
+                                  an, b.digits[i]);
+        add_into(digits.data() + i + an, n - i - an, &cr, 1);
+    }
+    trim();
     return *this;
 }
 
 
-// Modulo assignment operator [%=]
-// Divides the value of *this by the value of the right 
-// operand and assigns the remainder to *this. Produces NaN 
-// if the divisor is zero or any of the operands is NaN.
-VeryLongInt& VeryLongInt::operator %=(const VeryLongInt& that) 
+// Single-digit multiplication
+// Multiplies the value of *this by m in place, in one pass over 
+// the digits. Leaves NaN unchanged.
+VeryLongInt& VeryLongInt::mulSmall(std::uint64_t m) &
 {
     if (!isValid())
         return *this;
 
-    if (!that.isValid() || that == 0)
-        return *this = NaN();
+    if (!m) {
+        digits.assign(1, 0);
+        return *this;
+    }
+    digit_t cr = mul_add_digit(digits.data(), digits.data(), 
+                               digits.size(), m, 0);
+    if (cr) digits.push_back(cr);
+    return *this;
+}
+
+
+// Single-digit division
+// Divides the value of *this by d in place, in one pass over the 
+// digits, and returns the remainder. Produces NaN, and returns 0, 
+// if d is zero or *this is NaN.
+std::uint64_t VeryLongInt::divmodSmall(std::uint64_t d) &
+{
+    if (!isValid() || !d) {
+        *this = NaN();
+        return 0;
+    }
+
+    digit_t rem = div_digit(digits.data(), digits.data(), digits.size(), d);
+    trim();
+    return rem;
+}
+
+
+// Single-digit addition
+// Adds a to the value of *this in place, stopping as soon as the 
+// carry does. Leaves NaN unchanged.
+VeryLongInt& VeryLongInt::addSmall(std::uint64_t a) &
+{
+    if (!isValid())
+        return *this;
+
+    digit_t cr = a;
+    for (size_t i = 0; cr && i < digits.size(); i++) {
+        digits[i] += cr;
+        cr = digits[i] < cr;
+    }
+    if (cr) digits.push_back(cr);
+    return *this;
+}
+
+
+// Division assignment operator [/=]
+// Divides the value of *this by the value of the right 
+// operand and assigns the result to *this. Produces NaN 
+// if the divisor is zero or any of the operands is NaN.
+VeryLongInt& VeryLongInt::operator /=(const VeryLongInt& that) &
+{
+    VeryLongInt remainder;
+    divmod(*this, that, *this, remainder);
+    return *this;
+}
+
 
-    VeryLongInt x = *this;
-    x /= that;
-    x *= that;
-    *this -= x;
+// Modulo assignment operator [%=]
+// Divides the value of *this by the value of the right 
+// operand and assigns the remainder to *this. Produces NaN 
+// if the divisor is zero or any of the operands is NaN.
+VeryLongInt& VeryLongInt::operator %=(const VeryLongInt& that) &
+{
+    VeryLongInt quotient;
+    divmod(*this, that, quotient, *this);
     return *this;
 }
 
@@ -291,7 +2051,7 @@ VeryLongInt& VeryLongInt::operator %=(const VeryLongInt& that)
 // Moves the specified amount of bits of *this value to the 
 // right and assigns the result to it. Excess bits shifted 
 // off to the right are discarded.
-VeryLongInt& VeryLongInt::operator >>=(unsigned int n) 
+VeryLongInt& VeryLongInt::operator >>=(unsigned int n) &
 {
     if (!isValid())
         return *this;
@@ -300,17 +2060,8 @@ VeryLongInt& VeryLongInt::operator >>=(unsigned int n)
     if (!(n %= LOGB))
         return *this;
 
-    digit_t cr = 0;
-    auto it = digits.rbegin();
-    while (it != digits.rend()) {
-        cr = (cr << LOGB) + *it;
-        *it = cr >> n;
-        cr &= ~-(1LL << n);
-        it++;
-    }
-
-    if (digits.size() > 1 && !digits.back()) 
-        digits.pop_back();
+    shift_right(digits.data(), digits.data(), digits.size(), n);
+    trim();
     return *this;
 }
 
@@ -319,7 +2070,7 @@ VeryLongInt& VeryLongInt::operator >>=(unsigned int n)
 // Moves the specified amount of bits of *this value to the 
 // left and assigns the result to the variable. Zero bits 
 // are shifted in from the right.
-VeryLongInt& VeryLongInt::operator <<=(unsigned int n) 
+VeryLongInt& VeryLongInt::operator <<=(unsigned int n) &
 {
     if (!isValid())
         return *this;
@@ -328,18 +2079,7 @@ VeryLongInt& VeryLongInt::operator <<=(unsigned int n)
     if (!(n %= LOGB)) 
         return *this;
 
-    for (digit_t& digit : digits)
-        digit <<= n;
-
-    digit_t cr = 0;
-    auto it = digits.begin();
-    while (it != digits.end()) {
-        *it += cr;
-        cr = *it >> LOGB;
-        *it &= ~-BASE;
-        it++;
-    }
-
+    digit_t cr = shift_left(digits.data(), digits.data(), digits.size(), n);
     if (cr) digits.push_back(cr);
     return *this;
 }
@@ -377,6 +2117,159 @@ bool VeryLongInt::isValid() const
 }
 
 
+// Binary import
+// Returns the value of count words of size bytes at data, with the 
+// given order of the words and of the bytes within every word. Buffers 
+// laid out as the digits are copied at once, words of digit size in the 
+// byte order of the machine one by one, other ones byte by byte. 
+// Returns NaN if size is zero.
+VeryLongInt VeryLongInt::importWords(const void *data, size_t count, 
+                                     size_t size, Endian words, 
+                                     Endian bytes)
+{
+    if (!size)
+        return NaN();
+    if (!count)
+        return Zero();
+
+    const unsigned char *in = static_cast<const unsigned char*>(data);
+    const bool big_words = is_big(words), big_bytes = is_big(bytes);
+    const size_t digit_bytes = sizeof(digit_t);
+    VeryLongInt x;
+    x.digits.assign(std::max<size_t>(
+        (count * size + digit_bytes - 1) / digit_bytes, 1), 0);
+    if (!HOST_BIG_ENDIAN && !big_words && (size == 1 || !big_bytes)) {
+        std::memcpy(x.digits.data(), in, count * size);
+    }
+    else if (size == digit_bytes && big_bytes == HOST_BIG_ENDIAN) {
+        for (size_t w = 0; w < count; w++)
+            std::memcpy(&x.digits[w], in + (big_words ? count - 1 - w : w) 
+                        * size, size);
+    }
+    else {
+        for (size_t w = 0; w < count; w++) {
+            const unsigned char *word = in + (big_words ? count - 1 - w : w) 
+                                        * size;
+            for (size_t b = 0; b < size; b++) {
+                const size_t k = w * size + b;
+                const digit_t c = word[big_bytes ? size - 1 - b : b];
+                x.digits[k / digit_bytes] |= c << 8 * (k % digit_bytes);
+            }
+        }
+    }
+    x.trim();
+    return x;
+}
+
+
+// Binary export
+// Stores the value of *this at data, as wordCount(size) words of size 
+// bytes, with the given order of the words and of the bytes within 
+// every word, and returns the number of words. Zero and NaN take no 
+// words.
+size_t VeryLongInt::exportWords(void *data, size_t size, Endian words, 
+                                Endian bytes) const
+{
+    const size_t count = wordCount(size);
+    if (!count)
+        return 0;
+
+    unsigned char *out = static_cast<unsigned char*>(data);
+    const bool big_words = is_big(words), big_bytes = is_big(bytes);
+    const size_t digit_bytes = sizeof(digit_t);
+    if (!HOST_BIG_ENDIAN && !big_words && (size == 1 || !big_bytes)) {
+        const size_t n = std::min(count * size, digits.size() * digit_bytes);
+        std::memcpy(out, digits.data(), n);
+        std::memset(out + n, 0, count * size - n);
+        return count;
+    }
+    if (size == digit_bytes && big_bytes == HOST_BIG_ENDIAN) {
+        for (size_t w = 0; w < count; w++)
+            std::memcpy(out + (big_words ? count - 1 - w : w) * size, 
+                        &digits[w], size);
+        return count;
+    }
+
+    for (size_t w = 0; w < count; w++) {
+        unsigned char *word = out + (big_words ? count - 1 - w : w) * size;
+        for (size_t b = 0; b < size; b++) {
+            const size_t k = w * size + b;
+            unsigned char c = 0;
+            if (k / digit_bytes < digits.size())
+                c = static_cast<unsigned char>(
+                    digits[k / digit_bytes] >> 8 * (k % digit_bytes));
+            word[big_bytes ? size - 1 - b : b] = c;
+        }
+    }
+    return count;
+}
+
+
+// Returns the number of words of size bytes taken by the value 
+// of *this, 0 for zero and NaN.
+size_t VeryLongInt::wordCount(size_t size) const
+{
+    if (!*this || !size)
+        return 0;
+    const size_t bytes = (numberOfBinaryDigits() + 7) / 8;
+    return (bytes + size - 1) / size;
+}
+
+
+// Serialization
+// Appends the value of *this to out: its number of bytes n, shifted 
+// left by one bit and marked with the lowest bit for NaN, as a 
+// variable-length integer of 7-bit groups (least significant first, 
+// the highest bit set in all but the last byte), followed by the 
+// n bytes of the value, least significant first.
+void VeryLongInt::serialize(std::string& out) const
+{
+    const size_t n = wordCount(1);
+    std::uint64_t prefix = std::uint64_t(n) << 1 | !isValid();
+    do {
+        unsigned char c = prefix & 0x7f;
+        prefix >>= 7;
+        out.push_back(static_cast<char>(prefix ? c | 0x80 : c));
+    } while (prefix);
+
+    const size_t pos = out.size();
+    out.resize(pos + n);
+    exportWords(&out[pos], 1, Endian::Little, Endian::Little);
+}
+
+
+// Deserialization
+// Returns the value serialized at the position pos of the size bytes 
+// at data and advances pos past it. Returns NaN, leaving pos 
+// unchanged, if the data is truncated or malformed.
+VeryLongInt VeryLongInt::deserialize(const char *data, size_t size, 
+                                     size_t& pos)
+{
+    std::uint64_t prefix = 0;
+    size_t i = pos;
+    for (int shift = 0;; shift += 7) {
+        if (i >= size || shift >= 64)
+            return NaN();
+        const unsigned char c = data[i++];
+        prefix |= std::uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            break;
+    }
+
+    if (prefix & 1) {
+        if (prefix != 1)
+            return NaN();
+        pos = i;
+        return NaN();
+    }
+    const std::uint64_t n = prefix >> 1;
+    if (n > size - i)
+        return NaN();
+    pos = i + n;
+    return importWords(data + i, n, 1, Endian::Little, Endian::Little);
+}
+
+
 // Equality operator [==]
 // Returns true if the operands are valid numbers and are 
 // equal. If any of the operands is NaN returns false.
@@ -467,130 +2360,586 @@ bool operator >=(const VeryLongInt& lhs, const VeryLongInt& rhs)
 
 // Addition operator [+]
 // Returns the sum of the operands. Returns NaN if any 
-// of the operands is NaN.
-const VeryLongInt operator +(const VeryLongInt& lhs, const VeryLongInt& rhs)
+// of the operands is NaN. The overloads for rvalue operands 
+// (here and in the other operators) reuse their storage 
+// for the result, so chained expressions do not copy the 
+// intermediate results.
+VeryLongInt operator +(const VeryLongInt& lhs, const VeryLongInt& rhs)
 {
     VeryLongInt z = lhs;
     z += rhs;
     return z;
 }
 
+VeryLongInt operator +(VeryLongInt&& lhs, const VeryLongInt& rhs)
+{
+    lhs += rhs;
+    return std::move(lhs);
+}
+
+VeryLongInt operator +(const VeryLongInt& lhs, VeryLongInt&& rhs)
+{
+    rhs += lhs;
+    return std::move(rhs);
+}
+
+VeryLongInt operator +(VeryLongInt&& lhs, VeryLongInt&& rhs)
+{
+    lhs += rhs;
+    return std::move(lhs);
+}
+
 
 // Subtraction operator [-]
 // Returns the difference of the operands where the left 
 // operand is the minuend and the right operand is the 
 // subtrahend. Returns NaN if the result is negative or 
 // any of the operands is NaN.
-const VeryLongInt operator -(const VeryLongInt& lhs, const VeryLongInt& rhs)
+VeryLongInt operator -(const VeryLongInt& lhs, const VeryLongInt& rhs)
 {
     VeryLongInt z = lhs;
     z -= rhs;
     return z;
 }
 
+VeryLongInt operator -(VeryLongInt&& lhs, const VeryLongInt& rhs)
+{
+    lhs -= rhs;
+    return std::move(lhs);
+}
+
 
 // Multiplication operator [*]
 // Returns the product of the operands. Returns NaN if any 
 // of the operands is NaN.
-const VeryLongInt operator *(const VeryLongInt& lhs, const VeryLongInt& rhs)
+VeryLongInt operator *(const VeryLongInt& lhs, const VeryLongInt& rhs)
 {
     VeryLongInt z = lhs;
     z *= rhs;
     return z;
 }
 
+VeryLongInt operator *(VeryLongInt&& lhs, const VeryLongInt& rhs)
+{
+    lhs *= rhs;
+    return std::move(lhs);
+}
+
+VeryLongInt operator *(const VeryLongInt& lhs, VeryLongInt&& rhs)
+{
+    rhs *= lhs;
+    return std::move(rhs);
+}
+
+VeryLongInt operator *(VeryLongInt&& lhs, VeryLongInt&& rhs)
+{
+    lhs *= rhs;
+    return std::move(lhs);
+}
+
 
 // Division operator [/]
 // Returns the integer quotient of the operands where the 
 // left operand is the dividend and the right operand is 
 // the divisor. Returns NaN if the divisor is zero or any 
 // of the operands is NaN.
-const VeryLongInt operator /(const VeryLongInt& lhs, const VeryLongInt& rhs)
+VeryLongInt operator /(const VeryLongInt& lhs, const VeryLongInt& rhs)
 {
     VeryLongInt z = lhs;
     z /= rhs;
     return z;
 }
 
+VeryLongInt operator /(VeryLongInt&& lhs, const VeryLongInt& rhs)
+{
+    lhs /= rhs;
+    return std::move(lhs);
+}
+
 
 // Modulo operator [%]
 // Returns the remainder left over when the left operand 
 // is divided by the right operand. Returns NaN if the 
 // divisor is zero or any of the operands is NaN.
-const VeryLongInt operator %(const VeryLongInt& lhs, const VeryLongInt& rhs)
+VeryLongInt operator %(const VeryLongInt& lhs, const VeryLongInt& rhs)
 {
     VeryLongInt z = lhs;
     z %= rhs;
     return z;
 }
 
+VeryLongInt operator %(VeryLongInt&& lhs, const VeryLongInt& rhs)
+{
+    lhs %= rhs;
+    return std::move(lhs);
+}
+
+
+// Division with remainder
+// Divides x by y and assigns both the integer quotient and the 
+// remainder in a single pass. Produces NaN in both if the divisor 
+// is zero or any of the operands is NaN. The quotient and the 
+// remainder have to be distinct objects, but may be the operands.
+void divmod(const VeryLongInt& x, const VeryLongInt& y, 
+            VeryLongInt& quotient, VeryLongInt& remainder)
+{
+    if (!x.isValid() || !y.isValid() || y == 0) {
+        quotient = NaN();
+        remainder = NaN();
+        return;
+    }
+
+    if (x < y) {
+        remainder = x;
+        quotient = 0;
+        return;
+    }
+
+    const size_t un = x.digits.size(), vn = y.digits.size();
+    VeryLongInt q, r;
+    if (vn >= thresholds[3] && un - vn >= thresholds[3]) {
+        div_newton(x, y, q, r);
+        quotient = std::move(q);
+        remainder = std::move(r);
+        return;
+    }
+
+    q.digits.resize(un - vn + 1);
+    if (vn == 1) {
+        r = div_digit(q.digits.data(), x.digits.data(), un, y.digits[0]);
+    }
+    else {
+        int s = __builtin_clzll(y.digits.back());
+
+        VeryLongInt::DigitVector u(x.digits), v(y.digits);
+        u.push_back(s ? shift_left(u.data(), u.data(), un, s) : 0);
+        if (s) shift_left(v.data(), v.data(), vn, s);
+        div_knuth(q.digits.data(), u.data(), un, v.data(), vn);
+
+        r.digits.assign(u.begin(), u.begin() + vn);
+        if (s) shift_right(r.digits.data(), r.digits.data(), vn, s);
+    }
+    q.trim();
+    r.trim();
+    quotient = std::move(q);
+    remainder = std::move(r);
+}
+
+
+// Modular exponentiation
+// Returns base^exp mod modulus. Odd moduli use Montgomery 
+// multiplication with a sliding window, even ones fall back 
+// to binary exponentiation with a division per step. 
+// Returns NaN if the modulus is zero or any of the operands 
+// is NaN.
+VeryLongInt powmod(const VeryLongInt& base, const VeryLongInt& exp, 
+                   const VeryLongInt& modulus)
+{
+    if (!base.isValid() || !exp.isValid() || !modulus.isValid() || 
+        modulus == 0)
+        return NaN();
+
+    if (modulus.digits[0] & 1)
+        return VeryLongInt::Montgomery(modulus).powmod(base, exp);
+
+    VeryLongInt result = VeryLongInt(1) % modulus, b = base % modulus;
+    for (size_t i = exp.numberOfBinaryDigits(); i-- > 0;) {
+        result = result * result % modulus;
+        if ((exp.digits[i / VeryLongInt::LOGB] >> (i % VeryLongInt::LOGB)) & 1)
+            result = result * b % modulus;
+    }
+    return result;
+}
+
+
+// Integer square root
+// Returns the floor of the square root of x. The root of the high 
+// half of x, computed recursively, is refined with one Newton's 
+// iteration, s' = (s + x / s) / 2, which doubles its precision, and 
+// then corrected by a few units, so that the cost is a constant 
+// number of divisions of the length of x. Returns NaN if x is NaN.
+VeryLongInt isqrt(const VeryLongInt& x)
+{
+    if (!x.isValid())
+        return NaN();
+    if (!x)
+        return x;
+
+    const size_t b = x.numberOfBinaryDigits();
+    VeryLongInt s;
+    if (b <= 2 * VeryLongInt::LOGB) {
+        // Newton's iteration from above decreases until the root.
+        VeryLongInt next = VeryLongInt(1) << (b + 1) / 2;
+        do {
+            s = std::move(next);
+            next = (s + x / s) >> 1;
+        } while (next < s);
+        return s;
+    }
+
+    const size_t h = b / 4 - NEWTON_GUARD_BITS;
+    s = isqrt(x >> 2 * h) << h;
+    s = (s + x / s) >> 1;
+
+    while (s * s > x)
+        s -= 1;
+    VeryLongInt r = x - s * s;
+    while (r > s << 1) {
+        r -= (s << 1) + 1;
+        s.addSmall(1);
+    }
+    return s;
+}
+
+
+// Returns the greatest common divisor of a and b, by Lehmer's 
+// algorithm with Jebelean's double-digit steps: every step runs 
+// Euclid's algorithm on the leading 2 LIMB_BITS bits and applies its 
+// cofactors, below 2^LIMB_BITS, to the whole numbers at once, in 
+// a single linear pass, shortening them by about a digit. The steps 
+// Euclid's algorithm on the leading bits cannot take, with a large 
+// quotient, divide. If u is not null, tracks the cofactor of a and 
+// stores it in u, as gcdext.
+VeryLongInt VeryLongInt::gcdLehmer(const VeryLongInt& a, 
+                                   const VeryLongInt& b, VeryLongInt *u)
+{
+    // x = ux a and y = -uy a (mod b), both negated when neg is set.
+    VeryLongInt x = a, y = b, ux = 1, uy = 0;
+    bool neg = false;
+    if (x < y) {
+        std::swap(x, y);
+        std::swap(ux, uy);
+        neg = true;
+    }
+
+    while (y) {
+        const size_t n = x.digits.size();
+        const size_t bits = x.numberOfBinaryDigits();
+        const size_t h = bits > 2 * LOGB ? bits - 2 * LOGB : 0;
+        limb_t m[4];
+        const size_t k = lehmer_step(
+            leading_bits(x.digits.data(), n, h), 
+            leading_bits(y.digits.data(), y.digits.size(), h), !h, m);
+
+        if (!k) {
+            VeryLongInt q, r;
+            divmod(x, y, q, r);
+            if (u) {
+                ux.addProduct(q, uy);
+                std::swap(ux, uy);
+            }
+            x = std::move(y);
+            y = std::move(r);
+            neg = !neg;
+            continue;
+        }
+
+        y.digits.resize(n);
+        VeryLongInt nx, ny;
+        nx.digits.resize(n);
+        ny.digits.resize(n);
+        if (k % 2) {
+            mul_sub_pair(nx.digits.data(), y.digits.data(), m[1], 
+                         x.digits.data(), m[0], n);
+            mul_sub_pair(ny.digits.data(), x.digits.data(), m[2], 
+                         y.digits.data(), m[3], n);
+        }
+        else {
+            mul_sub_pair(nx.digits.data(), x.digits.data(), m[0], 
+                         y.digits.data(), m[1], n);
+            mul_sub_pair(ny.digits.data(), y.digits.data(), m[3], 
+                         x.digits.data(), m[2], n);
+        }
+        nx.trim();
+        ny.trim();
+        x = std::move(nx);
+        y = std::move(ny);
+
+        if (u) {
+            const size_t un = std::max(ux.digits.size(), uy.digits.size());
+            ux.digits.resize(un);
+            uy.digits.resize(un);
+            VeryLongInt nux, nuy;
+            nux.digits.resize(un);
+            nuy.digits.resize(un);
+            for (int i = 0; i < 2; i++) {
+                VeryLongInt& r = i ? nuy : nux;
+                dlimb_t cr = mul_add_pair(r.digits.data(), 
+                                          ux.digits.data(), m[2 * i], 
+                                          uy.digits.data(), m[2 * i + 1], 
+                                          un);
+                r.digits.push_back(static_cast<limb_t>(cr));
+                r.digits.push_back(static_cast<limb_t>(cr >> LIMB_BITS));
+                r.trim();
+            }
+            ux = std::move(nux);
+            uy = std::move(nuy);
+        }
+        neg ^= k % 2;
+    }
+
+    if (u) {
+        if (b) {
+            const VeryLongInt m = b / x;
+            ux %= m;
+            if (neg && ux)
+                ux = m - ux;
+        }
+        *u = std::move(ux);
+    }
+    return x;
+}
+
+
+// Returns the greatest common divisor of the operands, gcd(0, 0) = 0.
+VeryLongInt gcd(const VeryLongInt& a, const VeryLongInt& b)
+{
+    if (!a.isValid() || !b.isValid())
+        return NaN();
+    return VeryLongInt::gcdLehmer(a, b, nullptr);
+}
+
+
+// Returns the greatest common divisor of a and b and stores in u 
+// the cofactor of a, with a u = gcd(a, b) modulo b and 
+// 0 <= u < b / gcd(a, b), or u = 1 if b = 0.
+VeryLongInt gcdext(const VeryLongInt& a, const VeryLongInt& b, 
+                   VeryLongInt& u)
+{
+    if (!a.isValid() || !b.isValid()) {
+        u = NaN();
+        return NaN();
+    }
+    return VeryLongInt::gcdLehmer(a, b, &u);
+}
+
+
+// Returns the inverse of a modulo modulus, the u with a u = 1 modulo 
+// modulus and 0 <= u < modulus, or NaN if a and modulus are not 
+// coprime.
+VeryLongInt modinv(const VeryLongInt& a, const VeryLongInt& modulus)
+{
+    if (!a.isValid() || !modulus.isValid() || !modulus)
+        return NaN();
+
+    VeryLongInt u;
+    if (VeryLongInt::gcdLehmer(a, modulus, &u) != 1)
+        return NaN();
+    return u;
+}
+
+
+// Creates the context of the Montgomery arithmetic modulo the given 
+// modulus, which has to be odd; the context is invalid otherwise.
+VeryLongInt::Montgomery::Montgomery(const VeryLongInt& modulus) : 
+    mod(NaN()), r2(NaN()), inv(0)
+{
+    if (!modulus.isValid() || !(modulus.digits[0] & 1))
+        return;
+
+    // Newton's iteration doubles the number of correct low bits of 
+    // the inverse, starting from 3 (every odd x is its own inverse 
+    // modulo 8).
+    const digit_t m0 = modulus.digits[0];
+    digit_t x = m0;
+    for (int i = 0; i < 5; i++)
+        x *= 2 - m0 * x;
+    inv = -x;
+
+    mod = modulus;
+    r2 = (VeryLongInt(1) << 2 * LOGB * mod.digits.size()) % mod;
+}
+
+
+// Returns true if the modulus is odd.
+bool VeryLongInt::Montgomery::isValid() const
+{
+    return mod.isValid();
+}
+
+
+const VeryLongInt& VeryLongInt::Montgomery::modulus() const
+{
+    return mod;
+}
+
+
+// Stores the Montgomery product a b R^-1 mod the modulus of the n-digit 
+// residues a and b in r, which may alias them. Needs the scratch space 
+// t of 2n + 1 digits.
+void VeryLongInt::Montgomery::multiply(digit_t *r, const digit_t *a, 
+                                       const digit_t *b, digit_t *t) const
+{
+    const size_t n = mod.digits.size();
+    ::mul(t, a, n, b, n);
+    t[2 * n] = 0;
+    redc(r, t, mod.digits.data(), n, inv);
+}
+
+
+// Returns x mod the modulus, padded to the n digits of the modulus.
+VeryLongInt::DigitVector 
+VeryLongInt::Montgomery::residue(const VeryLongInt& x) const
+{
+    DigitVector d = (x % mod).digits;
+    d.resize(mod.digits.size(), 0);
+    return d;
+}
+
+
+// Returns the value of the n-digit residue.
+VeryLongInt VeryLongInt::Montgomery::fromDigits(const digit_t *x) const
+{
+    VeryLongInt r;
+    r.digits.assign(x, x + mod.digits.size());
+    r.trim();
+    return r;
+}
+
+
+// Returns a b mod the modulus. NaN if the context is invalid or any 
+// of the operands is NaN.
+VeryLongInt VeryLongInt::Montgomery::mulmod(const VeryLongInt& a, 
+                                            const VeryLongInt& b) const
+{
+    if (!isValid() || !a.isValid() || !b.isValid())
+        return NaN();
+
+    const size_t n = mod.digits.size();
+    DigitVector x = residue(a), y = residue(b), t(2 * n + 1, 0);
+    multiply(x.data(), x.data(), y.data(), t.data());
+    y = residue(r2);
+    multiply(x.data(), x.data(), y.data(), t.data());
+    return fromDigits(x.data());
+}
+
+
+// Returns base^exp mod the modulus, by left-to-right sliding-window 
+// exponentiation on residues in the Montgomery form, with a table of 
+// the odd powers of the base. NaN if the context is invalid or any 
+// of the operands is NaN.
+VeryLongInt VeryLongInt::Montgomery::powmod(const VeryLongInt& base, 
+                                            const VeryLongInt& exp) const
+{
+    if (!isValid() || !base.isValid() || !exp.isValid())
+        return NaN();
+
+    if (!exp)
+        return VeryLongInt(1) % mod;
+
+    const size_t n = mod.digits.size();
+    DigitVector g = residue(base), acc(n, 0), t(2 * n + 1, 0);
+    {
+        DigitVector rr = residue(r2);
+        multiply(g.data(), g.data(), rr.data(), t.data());
+    }
+
+    const size_t bits = exp.numberOfBinaryDigits();
+    const int w = window_size(bits);
+    std::vector<digit_t> table(n << (w - 1));
+    std::copy(g.begin(), g.end(), table.begin());
+    if (w > 1) {
+        multiply(g.data(), g.data(), g.data(), t.data());
+        for (size_t k = 1; k < size_t(1) << (w - 1); k++)
+            multiply(&table[k * n], &table[(k - 1) * n], g.data(), t.data());
+    }
+
+    auto bit = [&exp](size_t i) {
+        return (exp.digits[i / LOGB] >> (i % LOGB)) & 1;
+    };
+    bool started = false;
+    for (size_t i = bits; i-- > 0;) {
+        if (!bit(i)) {
+            multiply(acc.data(), acc.data(), acc.data(), t.data());
+            continue;
+        }
+        size_t j = i + 1 > size_t(w) ? i + 1 - w : 0;
+        while (!bit(j)) j++;
+        size_t val = 0;
+        for (size_t k = i + 1; k-- > j;)
+            val = (val << 1) | bit(k);
+
+        const digit_t *odd_power = &table[(val >> 1) * n];
+        if (started) {
+            for (size_t k = j; k <= i; k++)
+                multiply(acc.data(), acc.data(), acc.data(), t.data());
+            multiply(acc.data(), acc.data(), odd_power, t.data());
+        }
+        else {
+            std::copy(odd_power, odd_power + n, acc.begin());
+            started = true;
+        }
+        i = j;
+    }
+
+    DigitVector one(n, 0);
+    one[0] = 1;
+    multiply(acc.data(), acc.data(), one.data(), t.data());
+    return fromDigits(acc.data());
+}
+
 
 // Bitwise right shift operator [>>]
 // Returns the value of the first operand shifted by the 
 // specified number of bits to the right. Excess bits 
 // shifted off to the right are discarded. Zero bits are 
 // shifted in from the left. 
-const VeryLongInt operator >>(const VeryLongInt& lhs, unsigned int rhs)
+VeryLongInt operator >>(const VeryLongInt& lhs, unsigned int rhs)
 {
     VeryLongInt w = lhs;
     w >>= rhs;
     return w;
 }
 
+VeryLongInt operator >>(VeryLongInt&& lhs, unsigned int rhs)
+{
+    lhs >>= rhs;
+    return std::move(lhs);
+}
+
 
 // Bitwise left shift operator [<<]
 // Returns the value of the first operand shifted by the 
 // specified number of bits to the left. Zero bits are 
 // shifted in from the right.
-const VeryLongInt operator <<(const VeryLongInt& lhs, unsigned int rhs)
+VeryLongInt operator <<(const VeryLongInt& lhs, unsigned int rhs)
 {
     VeryLongInt w = lhs;
     w <<= rhs;
     return w; 
 }
 
+VeryLongInt operator <<(VeryLongInt&& lhs, unsigned int rhs)
+{
+    lhs <<= rhs;
+    return std::move(lhs);
+}
+
 
 // Output stream insertion operator [<<]
 // Inserts into the output stream a sequence of characters 
-// with the 10-base representation of the right operand.
+// with the representation of the right operand, in the base 
+// selected by std::dec, std::hex or std::oct. The std::showbase 
+// and std::uppercase flags apply as for the built-in integers.
 std::ostream& operator <<(std::ostream& os, const VeryLongInt& x) 
 {
     if (!x.isValid())
         return os << "NaN";
 
-    using digit_t = VeryLongInt::digit_t;
-
-    static const unsigned DEC_BASE = 1000000000U;   // 10^9
-    static const unsigned DEC_LOGB = 9U;            // log10(DEC_BASE)
-
-    const std::vector<digit_t>& bin_digits = x.digits;
-    std::vector<digit_t> dec_digits;
-    dec_digits.push_back(0);
-
-    auto bit = bin_digits.rbegin();
-    while (bit != bin_digits.rend()) {
-        for (digit_t& dec_digit : dec_digits)
-            dec_digit <<= VeryLongInt::LOGB;
-        dec_digits.front() += *bit;
-        bit++;
-
-        digit_t cr = 0;
-        auto dit = dec_digits.begin();
-        while (dit != dec_digits.end()) {
-            *dit += cr;
-            cr = *dit / DEC_BASE;
-            *dit %= DEC_BASE;
-            dit++;
-        }
-        if (cr) dec_digits.push_back(cr);
+    const std::ios_base::fmtflags flags = os.flags();
+    const std::ios_base::fmtflags base = flags & std::ios_base::basefield;
+    const bool upper = flags & std::ios_base::uppercase;
+    std::string str;
+    if (base == std::ios_base::hex || base == std::ios_base::oct) {
+        const bool hex = base == std::ios_base::hex;
+        if ((flags & std::ios_base::showbase) && x)
+            str = hex ? (upper ? "0X" : "0x") : "0";
+        x.toRadix(str, hex ? 4 : 3, upper);
     }
-
-    auto dit = dec_digits.rbegin();
-    os << *dit;
-    while (++dit != dec_digits.rend()) 
-        os << std::setw(DEC_LOGB) << std::setfill('0') << *dit;
-
-    return os;
+    else {
+        x.toDecimal(str, 0);
+    }
+    return os << str;
 }
 
 
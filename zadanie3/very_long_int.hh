@@ -4,25 +4,124 @@
 #include <cstddef>
 #include <cstdint>
 #include <iosfwd>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 class VeryLongInt
 {
+public:
+    /* Source of the memory for the digits */
+    class MemoryResource
+    {
+    public:
+        virtual ~MemoryResource() = default;
+        virtual void* allocate(std::size_t) = 0;
+        virtual void deallocate(void*, std::size_t) = 0;
+    };
+
+    class Arena;
+    class ResourceScope;
+    class Montgomery;
+    template <std::size_t N> class Fixed;
+
+    /* Parsers of the literals of the _vli operator */
+    template <unsigned Base, char... Cs> struct LiteralDigits;
+    template <char... Cs> struct Literal;
+
+    /* Memory resources */
+    static MemoryResource& defaultResource();
+    static MemoryResource& currentResource();
+
 private:
-    typedef std::int64_t digit_t;
+    typedef std::uint64_t digit_t;
 
-    static const int BASE;          // Numeral system radix
-    static const int LOGB;          // Binary logarithm of the radix
+    /* Vector of digits, stored inline up to INLINE_DIGITS */
+    class DigitVector
+    {
+    public:
+        static const std::size_t INLINE_DIGITS = 4;
+
+        DigitVector();
+        DigitVector(std::size_t, digit_t);
+        DigitVector(const DigitVector&);
+        DigitVector(DigitVector&&);
+        ~DigitVector();
+
+        DigitVector& operator =(const DigitVector&);
+        DigitVector& operator =(DigitVector&&);
+
+        std::size_t size() const { return len; }
+        bool empty() const { return len == 0; }
+
+        digit_t* data() { return ptr; }
+        const digit_t* data() const { return ptr; }
+        digit_t* begin() { return ptr; }
+        const digit_t* begin() const { return ptr; }
+        digit_t* end() { return ptr + len; }
+        const digit_t* end() const { return ptr + len; }
+
+        digit_t& operator [](std::size_t i) { return ptr[i]; }
+        const digit_t& operator [](std::size_t i) const { return ptr[i]; }
+        digit_t& back() { return ptr[len - 1]; }
+        const digit_t& back() const { return ptr[len - 1]; }
+
+        void push_back(digit_t d) {
+            if (len == cap) reserve(2 * cap);
+            ptr[len++] = d;
+        }
+        void pop_back() { len--; }
+        void clear() { len = 0; }
+
+        void reserve(std::size_t);
+        void resize(std::size_t, digit_t = 0);
+        void assign(std::size_t, digit_t);
+        void assign(const digit_t*, const digit_t*);
+        void erase(digit_t*, digit_t*);
 
-    std::vector<digit_t> digits;    // Vector of digits
+    private:
+        digit_t *ptr;               // Digits, buf or from res
+        std::size_t len, cap;       // Size and capacity
+        MemoryResource *res;        // Source of the memory
+        digit_t buf[INLINE_DIGITS]; // Inline storage
+
+        bool isInline() const { return ptr == buf; }
+    };
+
+    DigitVector digits;             // Vector of digits
 
     /* Helper methods */
-    void align();
+    void trim();
     void lshift(std::size_t);
     void rshift(std::size_t);
+    static VeryLongInt fromDecimal(const char*, std::size_t);
+    void toDecimal(std::string&, std::size_t) const;
+    static VeryLongInt fromRadix(const char*, std::size_t, int);
+    void toRadix(std::string&, int, bool) const;
+    static VeryLongInt gcdLehmer(const VeryLongInt&, const VeryLongInt&, 
+                                 VeryLongInt*);
+
+    VeryLongInt(const digit_t*, std::size_t);
 
 public:
+    static const int LOGB;          // Binary logarithm of the radix
+
+    /* Algorithm thresholds */
+    enum class Threshold {
+        Karatsuba,                  // Karatsuba multiplication
+        Toom3,                      // Toom-Cook 3-way multiplication
+        Ntt,                        // Number-theoretic transform
+        Newton,                     // Newton's reciprocal division
+        Parallel                    // Parallel sub-products
+    };
+
+    static std::size_t getThreshold(Threshold);
+    static void setThreshold(Threshold, std::size_t);
+
+    /* Parallel execution (1 thread, serial, by default) */
+    static unsigned getThreadCount();
+    static void setThreadCount(unsigned);
+
     /* Constructors */
     VeryLongInt();
     VeryLongInt(const VeryLongInt&);
@@ -45,27 +144,57 @@ public:
     explicit VeryLongInt(const std::string&);
     explicit VeryLongInt(const char*);
 
+    /* Conversions in base 10 or 2, 4, 8, 16, 32 */
+    static VeryLongInt fromString(const std::string&, unsigned);
+    static VeryLongInt fromHex(const std::string&);
+    std::string toString(unsigned = 10) const;
+
+    template <std::size_t N>
+    VeryLongInt(const Fixed<N>& x) : VeryLongInt(x.digits, N) {}
+
     /* Destructor */
     ~VeryLongInt() = default;
 
     /* Basic assignment operator */
-    VeryLongInt& operator =(const VeryLongInt&);
-    VeryLongInt& operator =(VeryLongInt&&);
+    VeryLongInt& operator =(const VeryLongInt&) &;
+    VeryLongInt& operator =(VeryLongInt&&) &;
 
     /* Compound arithmetic assignment operators */
-    VeryLongInt& operator +=(const VeryLongInt&);
-    VeryLongInt& operator -=(const VeryLongInt&);
-    VeryLongInt& operator *=(const VeryLongInt&);
-    VeryLongInt& operator /=(const VeryLongInt&);
-    VeryLongInt& operator %=(const VeryLongInt&);
+    VeryLongInt& operator +=(const VeryLongInt&) &;
+    VeryLongInt& operator -=(const VeryLongInt&) &;
+    VeryLongInt& operator *=(const VeryLongInt&) &;
+    VeryLongInt& operator /=(const VeryLongInt&) &;
+    VeryLongInt& operator %=(const VeryLongInt&) &;
+
+    /* Fused multiply-add (*this += x * y) */
+    VeryLongInt& addProduct(const VeryLongInt&, const VeryLongInt&) &;
+
+    /* Single-digit arithmetic in place, without temporaries */
+    VeryLongInt& mulSmall(std::uint64_t) &;
+    std::uint64_t divmodSmall(std::uint64_t) &;   // Returns the remainder
+    VeryLongInt& addSmall(std::uint64_t) &;
 
     /* Compound bitshift assignment operators */
-    VeryLongInt& operator >>=(unsigned int);
-    VeryLongInt& operator <<=(unsigned int);
+    VeryLongInt& operator >>=(unsigned int) &;
+    VeryLongInt& operator <<=(unsigned int) &;
 
     /* Number of binary digits */
     std::size_t numberOfBinaryDigits() const;
 
+    /* Byte order within words, and order of words in buffers */
+    enum class Endian { Little, Big, Native };
+
+    /* Binary import and export of words of the given size 
+       (data, count, size, order of words, order of bytes) */
+    static VeryLongInt importWords(const void*, std::size_t, std::size_t, 
+                                   Endian, Endian);
+    std::size_t exportWords(void*, std::size_t, Endian, Endian) const;
+    std::size_t wordCount(std::size_t) const;
+
+    /* Length-prefixed serialization (data, size, position) */
+    void serialize(std::string&) const;
+    static VeryLongInt deserialize(const char*, std::size_t, std::size_t&);
+
     /* Conversion operator */
     explicit operator bool() const;
 
@@ -77,20 +206,66 @@ public:
     friend bool operator ==(const VeryLongInt&, const VeryLongInt&);
     friend bool operator  <(const VeryLongInt&, const VeryLongInt&);
 
+    /* Division with remainder */
+    friend void divmod(const VeryLongInt&, const VeryLongInt&, 
+                       VeryLongInt&, VeryLongInt&);
+
+    /* Modular exponentiation */
+    friend VeryLongInt powmod(const VeryLongInt&, const VeryLongInt&, 
+                              const VeryLongInt&);
+
+    /* Greatest common divisor and modular inverse */
+    friend VeryLongInt gcd(const VeryLongInt&, const VeryLongInt&);
+    friend VeryLongInt gcdext(const VeryLongInt&, const VeryLongInt&, 
+                              VeryLongInt&);
+    friend VeryLongInt modinv(const VeryLongInt&, const VeryLongInt&);
+
     /* Stream insertion operator */
     friend std::ostream& operator <<(std::ostream&, const VeryLongInt&);
 };
 
 /* Arithmetic operators */
-const VeryLongInt operator +(const VeryLongInt&, const VeryLongInt&);
-const VeryLongInt operator -(const VeryLongInt&, const VeryLongInt&);
-const VeryLongInt operator *(const VeryLongInt&, const VeryLongInt&);
-const VeryLongInt operator /(const VeryLongInt&, const VeryLongInt&);
-const VeryLongInt operator %(const VeryLongInt&, const VeryLongInt&);
+VeryLongInt operator +(const VeryLongInt&, const VeryLongInt&);
+VeryLongInt operator +(VeryLongInt&&, const VeryLongInt&);
+VeryLongInt operator +(const VeryLongInt&, VeryLongInt&&);
+VeryLongInt operator +(VeryLongInt&&, VeryLongInt&&);
+VeryLongInt operator -(const VeryLongInt&, const VeryLongInt&);
+VeryLongInt operator -(VeryLongInt&&, const VeryLongInt&);
+VeryLongInt operator *(const VeryLongInt&, const VeryLongInt&);
+VeryLongInt operator *(VeryLongInt&&, const VeryLongInt&);
+VeryLongInt operator *(const VeryLongInt&, VeryLongInt&&);
+VeryLongInt operator *(VeryLongInt&&, VeryLongInt&&);
+VeryLongInt operator /(const VeryLongInt&, const VeryLongInt&);
+VeryLongInt operator /(VeryLongInt&&, const VeryLongInt&);
+VeryLongInt operator %(const VeryLongInt&, const VeryLongInt&);
+VeryLongInt operator %(VeryLongInt&&, const VeryLongInt&);
+
+/* Division with remainder */
+void divmod(const VeryLongInt&, const VeryLongInt&, 
+            VeryLongInt&, VeryLongInt&);
+
+/* Modular exponentiation (base^exp mod modulus) */
+VeryLongInt powmod(const VeryLongInt&, const VeryLongInt&, 
+                   const VeryLongInt&);
+
+/* Integer square root (floor) */
+VeryLongInt isqrt(const VeryLongInt&);
+
+/* Greatest common divisor */
+VeryLongInt gcd(const VeryLongInt&, const VeryLongInt&);
+
+/* Extended gcd (a, b, u): returns gcd(a, b) and stores in u the 
+   cofactor with a u = gcd (mod b), 0 <= u < b / gcd (1 if b = 0) */
+VeryLongInt gcdext(const VeryLongInt&, const VeryLongInt&, VeryLongInt&);
+
+/* Modular inverse (a^-1 mod modulus, NaN if there is none) */
+VeryLongInt modinv(const VeryLongInt&, const VeryLongInt&);
 
 /* Bitwise shift operators */
-const VeryLongInt operator >>(const VeryLongInt&, unsigned int);
-const VeryLongInt operator <<(const VeryLongInt&, unsigned int);
+VeryLongInt operator >>(const VeryLongInt&, unsigned int);
+VeryLongInt operator >>(VeryLongInt&&, unsigned int);
+VeryLongInt operator <<(const VeryLongInt&, unsigned int);
+VeryLongInt operator <<(VeryLongInt&&, unsigned int);
 
 /* Relational operators */
 bool operator ==(const VeryLongInt&, const VeryLongInt&);
@@ -107,4 +282,264 @@ std::ostream& operator <<(std::ostream&, const VeryLongInt&);
 const VeryLongInt& NaN();
 const VeryLongInt& Zero();
 
+/* Monotonic arena: deallocation reclaims only the last allocation and 
+   the whole memory is freed at once by release() or the destructor */
+class VeryLongInt::Arena : public VeryLongInt::MemoryResource
+{
+public:
+    explicit Arena(std::size_t = 64 * 1024);
+    Arena(const Arena&) = delete;
+    Arena& operator =(const Arena&) = delete;
+    ~Arena();
+
+    void* allocate(std::size_t) override;
+    void deallocate(void*, std::size_t) override;
+    void release();
+
+private:
+    std::vector<void*> blocks;      // Allocated blocks
+    std::size_t blockSize;          // Size of the next block
+    char *cur, *end;                // Free part of the last block
+};
+
+/* Makes the given resource the current one of this thread for the 
+   lifetime of the scope. Values allocated from an arena must not 
+   outlive it; copies made after the scope use the outer resource. */
+class VeryLongInt::ResourceScope
+{
+public:
+    explicit ResourceScope(MemoryResource&);
+    ResourceScope(const ResourceScope&) = delete;
+    ResourceScope& operator =(const ResourceScope&) = delete;
+    ~ResourceScope();
+
+private:
+    MemoryResource *previous;
+};
+
+/* Montgomery arithmetic modulo a fixed odd modulus, for repeated 
+   multiplications and exponentiations without division */
+class VeryLongInt::Montgomery
+{
+public:
+    explicit Montgomery(const VeryLongInt&);
+
+    bool isValid() const;
+    const VeryLongInt& modulus() const;
+
+    VeryLongInt mulmod(const VeryLongInt&, const VeryLongInt&) const;
+    VeryLongInt powmod(const VeryLongInt&, const VeryLongInt&) const;
+
+private:
+    VeryLongInt mod;                // Modulus, NaN if even or zero
+    VeryLongInt r2;                 // R^2 mod the modulus, R = 2^(LOGB n)
+    digit_t inv;                    // -modulus^-1 mod 2^LOGB
+
+    void multiply(digit_t*, const digit_t*, const digit_t*, digit_t*) const;
+    DigitVector residue(const VeryLongInt&) const;
+    VeryLongInt fromDigits(const digit_t*) const;
+};
+
+/* Number of at most N digits with constexpr arithmetic, for constants 
+   computed at compile time. The sums and products grow to fit, the 
+   differences must not be negative. Converts to VeryLongInt by a copy 
+   of the digits. */
+template <std::size_t N>
+class VeryLongInt::Fixed
+{
+    __extension__ typedef unsigned __int128 wide_t;
+
+    template <std::size_t... I> struct Indices {};
+    template <std::size_t K, std::size_t... I>
+    struct MakeIndices : MakeIndices<K - 1, K - 1, I...> {};
+    template <std::size_t... I>
+    struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+public:
+    std::uint64_t digits[N];        // Digits, least significant first
+
+    constexpr std::uint64_t digit(std::size_t i) const {
+        return i < N ? digits[i] : 0;
+    }
+
+    /* *this m + a, which has to fit in N digits */
+    constexpr Fixed mulAdd(std::uint64_t m, std::uint64_t a) const {
+        return mulAddCarry(m, a, N)
+            ? throw std::overflow_error("VeryLongInt::Fixed overflow")
+            : mulAdd(m, a, typename MakeIndices<N>::type());
+    }
+
+    /* The number with the n digits at s in the base appended, 
+       a digit at a time */
+    constexpr Fixed append(unsigned base, const char *s, 
+                           std::size_t n) const {
+        return n == 0 ? *this : append(base, s, n, 
+            n < chunkLength(base) ? n : chunkLength(base));
+    }
+
+    template <std::size_t M>
+    constexpr Fixed<(N > M ? N : M) + 1> operator +(const Fixed<M>& y) const {
+        return add<(N > M ? N : M) + 1>(
+            y, typename MakeIndices<(N > M ? N : M) + 1>::type());
+    }
+
+    template <std::size_t M>
+    constexpr Fixed<(N > M ? N : M)> operator -(const Fixed<M>& y) const {
+        return subBorrow(y, N > M ? N : M)
+            ? throw std::range_error("negative VeryLongInt::Fixed")
+            : sub<(N > M ? N : M)>(
+                y, typename MakeIndices<(N > M ? N : M)>::type());
+    }
+
+    template <std::size_t M>
+    constexpr Fixed<N + M> operator *(const Fixed<M>& y) const {
+        return mul<N + M>(y, typename MakeIndices<N + M>::type());
+    }
+
+private:
+    /* Number of the digits in the base which fit in a digit */
+    static constexpr std::size_t chunkLength(unsigned base) {
+        return base == 10 ? 19 : base == 16 ? 15 : base == 8 ? 21 : 63;
+    }
+
+    /* Value, appended to v, and power of the base of the n digits at s, 
+       skipping the digit separators */
+    static constexpr std::uint64_t chunkValue(unsigned base, const char *s, 
+                                              std::size_t n, 
+                                              std::uint64_t v) {
+        return n == 0 ? v : chunkValue(base, s + 1, n - 1, 
+            *s == '\'' ? v : v * base + digitValue(*s, base));
+    }
+
+    static constexpr std::uint64_t chunkPower(unsigned base, const char *s, 
+                                              std::size_t n) {
+        return n == 0 ? 1 : 
+            (*s == '\'' ? 1 : base) * chunkPower(base, s + 1, n - 1);
+    }
+
+    constexpr Fixed append(unsigned base, const char *s, std::size_t n, 
+                           std::size_t k) const {
+        return mulAdd(chunkPower(base, s, k), chunkValue(base, s, k, 0))
+            .append(base, s + k, n - k);
+    }
+
+    static constexpr std::uint64_t digitValue(char c, unsigned base) {
+        return c >= '0' && c <= '9' && unsigned(c - '0') < base ? c - '0'
+            : c >= 'a' && c <= 'f' && base == 16 ? c - 'a' + 10
+            : c >= 'A' && c <= 'F' && base == 16 ? c - 'A' + 10
+            : throw std::invalid_argument("invalid VeryLongInt literal");
+    }
+
+    /* Carry into the i-th digit of *this m + a */
+    constexpr std::uint64_t mulAddCarry(std::uint64_t m, std::uint64_t a, 
+                                        std::size_t i) const {
+        return i == 0 ? a : std::uint64_t(
+            (wide_t(digits[i - 1]) * m + mulAddCarry(m, a, i - 1)) >> 64);
+    }
+
+    template <std::size_t... I>
+    constexpr Fixed mulAdd(std::uint64_t m, std::uint64_t a, 
+                           Indices<I...>) const {
+        return Fixed{{ std::uint64_t(
+            wide_t(digits[I]) * m + mulAddCarry(m, a, I))... }};
+    }
+
+    /* Carry into the i-th digit of *this + y */
+    template <std::size_t M>
+    constexpr std::uint64_t addCarry(const Fixed<M>& y, std::size_t i) const {
+        return i == 0 ? 0 : std::uint64_t((wide_t(digit(i - 1)) + 
+            y.digit(i - 1) + addCarry(y, i - 1)) >> 64);
+    }
+
+    template <std::size_t K, std::size_t M, std::size_t... I>
+    constexpr Fixed<K> add(const Fixed<M>& y, Indices<I...>) const {
+        return Fixed<K>{{ std::uint64_t(
+            digit(I) + y.digit(I) + addCarry(y, I))... }};
+    }
+
+    /* Borrow from the i-th digit of *this - y */
+    template <std::size_t M>
+    constexpr std::uint64_t subBorrow(const Fixed<M>& y, std::size_t i) const {
+        return i == 0 ? 0 : wide_t(digit(i - 1)) < 
+            wide_t(y.digit(i - 1)) + subBorrow(y, i - 1);
+    }
+
+    template <std::size_t K, std::size_t M, std::size_t... I>
+    constexpr Fixed<K> sub(const Fixed<M>& y, Indices<I...>) const {
+        return Fixed<K>{{ std::uint64_t(
+            digit(I) - y.digit(I) - subBorrow(y, I))... }};
+    }
+
+    /* Sum of the low halves of the products of the k-th column of 
+       *this y and of the high halves of the (k - 1)-th one, from the 
+       j-th digit of *this */
+    template <std::size_t M>
+    constexpr wide_t mulColumn(const Fixed<M>& y, std::size_t k, 
+                               std::size_t j) const {
+        return j >= N || j > k ? 0 :
+            wide_t(std::uint64_t(wide_t(digits[j]) * y.digit(k - j))) + 
+            (j < k ? (wide_t(digits[j]) * y.digit(k - 1 - j)) >> 64 : 0) + 
+            mulColumn(y, k, j + 1);
+    }
+
+    /* The k-th column of *this y with the carry from the lower ones */
+    template <std::size_t M>
+    constexpr wide_t mulDigit(const Fixed<M>& y, std::size_t k) const {
+        return mulColumn(y, k, 0) + (k == 0 ? 0 : mulDigit(y, k - 1) >> 64);
+    }
+
+    template <std::size_t K, std::size_t M, std::size_t... I>
+    constexpr Fixed<K> mul(const Fixed<M>& y, Indices<I...>) const {
+        return Fixed<K>{{ std::uint64_t(mulDigit(y, I))... }};
+    }
+};
+
+/* The value of a literal of the given digits in the base; 19 decimal, 
+   16 hexadecimal, 21 octal or 64 binary digits fit in a digit */
+template <unsigned Base, char... Cs>
+struct VeryLongInt::LiteralDigits
+{
+    static constexpr std::size_t count = sizeof...(Cs);
+    typedef Fixed<(Base == 10 ? (count + 18) / 19 : Base == 16 ? 
+                   (count + 15) / 16 : Base == 8 ? (3 * count + 63) / 64 : 
+                   (count + 63) / 64)> type;
+
+    static constexpr char text[count] = { Cs... };
+    static constexpr type value = type{{}}.append(Base, text, count);
+};
+
+template <unsigned Base, char... Cs>
+constexpr char VeryLongInt::LiteralDigits<Base, Cs...>::text[];
+
+template <unsigned Base, char... Cs>
+constexpr typename VeryLongInt::LiteralDigits<Base, Cs...>::type 
+    VeryLongInt::LiteralDigits<Base, Cs...>::value;
+
+/* The base is given by the prefix, as for the integer literals */
+template <char... Cs>
+struct VeryLongInt::Literal : LiteralDigits<10, Cs...> {};
+
+template <char C, char... Cs>
+struct VeryLongInt::Literal<'0', C, Cs...> : LiteralDigits<8, C, Cs...> {};
+
+template <char... Cs>
+struct VeryLongInt::Literal<'0', 'x', Cs...> : LiteralDigits<16, Cs...> {};
+
+template <char... Cs>
+struct VeryLongInt::Literal<'0', 'X', Cs...> : LiteralDigits<16, Cs...> {};
+
+template <char... Cs>
+struct VeryLongInt::Literal<'0', 'b', Cs...> : LiteralDigits<2, Cs...> {};
+
+template <char... Cs>
+struct VeryLongInt::Literal<'0', 'B', Cs...> : LiteralDigits<2, Cs...> {};
+
+/* Compile-time literal, e.g. 123456789012345678901234567890_vli, which 
+   converts to VeryLongInt without parsing */
+template <char... Cs>
+constexpr typename VeryLongInt::Literal<Cs...>::type operator "" _vli()
+{
+    return VeryLongInt::Literal<Cs...>::value;
+}
+
 #endif /* VERY_LONG_INT_HH */